@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,10 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Buffers are hashed by (dev, blockno) into NBUCKET buckets,
+// each with its own lock and its own LRU list, so that lookups
+// of different blocks on different CPUs do not contend.
 
 
 #include "types.h"
@@ -23,32 +27,120 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+#define NBUCKET 509    // prime, so that strided block numbers spread out
+#define BCACHEFRAC 32  // use about 1/BCACHEFRAC of free memory at boot
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
+  // Linked list of the buffers in this bucket, through prev/next.
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+};
+
+struct {
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+int nbuf;  // number of buffers in the cache, set by binit()
+
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+// Unlink b from whatever bucket list it is on.
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Insert b at the most-recently-used end of bk's list.
+static void
+bpush(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+// Look for block (dev, blockno) in bk.
+// Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
+// Allocate a buffer that is on no list, carving its header
+// and its data out of pages from kalloc().
+// Used at boot, for the cache and for the log's own buffers,
+// so needs no lock.
+// Returns 0 if out of memory.
+struct buf*
+bufalloc(void)
+{
+  static char *hdr, *data;  // unused part of the current pages
+  static int nhdr, ndata;
+  struct buf *b;
+
+  if(nhdr == 0){
+    if((hdr = kalloc()) == 0)
+      return 0;
+    nhdr = PGSIZE / sizeof(struct buf);
+  }
+  if(ndata == 0){
+    if((data = kalloc()) == 0)
+      return 0;
+    ndata = PGSIZE / BSIZE;
+  }
+  b = (struct buf*)hdr;
+  hdr += sizeof(struct buf);
+  nhdr--;
+  memset(b, 0, sizeof(*b));
+  b->data = (uchar*)data;
+  data += BSIZE;
+  ndata--;
+  initsleeplock(&b->lock, "buffer");
+  return b;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
+  int i;
 
-  initlock(&bcache.lock, "bcache");
-
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+
+  // Size the cache from the memory that is free at boot,
+  // but make it no smaller than NBUF.
+  nbuf = (uint64)knfree() * PGSIZE / BCACHEFRAC / (BSIZE + sizeof(struct buf));
+  if(nbuf < NBUF)
+    nbuf = NBUF;
+
+  // Spread the buffers over the buckets; bget() moves them
+  // to whichever bucket needs them.
+  for(i = 0; i < nbuf; i++){
+    if((b = bufalloc()) == 0)
+      panic("binit");
+    bpush(&bcache.bucket[i % NBUCKET], b);
   }
 }
 
@@ -58,29 +150,61 @@ binit(void)
 static struct buf*
 bget(uint dev, uint blockno)
 {
+  struct bucket *bk, *vk, *lo, *hi;
   struct buf *b;
+  int h, i;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
+  // Recycle the least recently used unused buffer, looking in
+  // this block's own bucket first and then in the others.
+  // At most two bucket locks are held at once, always taken in
+  // index order, so concurrent misses cannot deadlock.  The home
+  // bucket is checked again each time its lock is re-acquired,
+  // since another process may have cached the block meanwhile.
+  h = bk - bcache.bucket;
+  for(i = 0; i < NBUCKET; i++){
+    vk = &bcache.bucket[(h + i) % NBUCKET];
+    lo = bk < vk ? bk : vk;
+    hi = bk < vk ? vk : bk;
+    acquire(&lo->lock);
+    if(hi != lo)
+      acquire(&hi->lock);
+
+    if((b = bfind(bk, dev, blockno)) != 0){
+      b->refcnt++;
+    } else {
+      for(b = vk->head.prev; b != &vk->head; b = b->prev){
+        if(b->refcnt == 0)
+          break;
+      }
+      if(b != &vk->head){
+        b->dev = dev;
+        b->blockno = blockno;
+        b->valid = 0;
+        b->refcnt = 1;
+        bunlink(b);
+        bpush(bk, b);
+      } else {
+        b = 0;
+      }
+    }
+
+    if(hi != lo)
+      release(&hi->lock);
+    release(&lo->lock);
+    if(b){
       acquiresleep(&b->lock);
       return b;
     }
@@ -102,6 +226,15 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block without reading
+// it from the disk, for a caller that is about to overwrite
+// all of b->data. The caller sets b->valid once it has.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  return bget(dev, blockno);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,8 +244,62 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Read the blocks named by the n bufs in bs from disk, with
+// all of the reads in flight at once.  Must be locked.
+void
+breadv(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("breadv");
+  }
+  virtio_disk_submit(bs, n, 0);
+  for(i = 0; i < n; i++){
+    virtio_disk_wait(bs[i]);
+    bs[i]->valid = 1;
+  }
+}
+
+// Write the contents of the n bufs in bs to disk, with
+// all of the writes in flight at once.  Must be locked.
+void
+bwritev(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+  }
+  virtio_disk_submit(bs, n, 1);
+  for(i = 0; i < n; i++)
+    virtio_disk_wait(bs[i]);
+}
+
+// Drop a reference to b, making it the most recently
+// used buffer in its bucket if that was the last one.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  // b's identity cannot change while refcnt > 0,
+  // so its bucket is stable until refcnt drops below.
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    bunlink(b);
+    bpush(bk, b);
+  }
+  release(&bk->lock);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Move to the head of its bucket's most-recently-used list.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +307,61 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+// Start reading the n blocks in blocknos into the cache,
+// without waiting for the disk. Blocks already cached are
+// skipped. Each buffer stays locked until bdone() runs.
+void
+breadahead(uint dev, uint *blocknos, int n)
+{
+  struct buf *bs[RAMAX];
+  struct buf *b;
+  int i, m;
+
+  if(n > RAMAX)
+    panic("breadahead");
+  m = 0;
+  for(i = 0; i < n; i++){
+    b = bget(dev, blocknos[i]);
+    if(b->valid){
+      brelse(b);
+      continue;
+    }
+    b->async = 1;
+    bs[m++] = b;
   }
-  
-  release(&bcache.lock);
+  if(m > 0)
+    virtio_disk_submit(bs, m, 0);
+}
+
+// Called by the disk interrupt when a read started by
+// breadahead() has finished. Releases the buffer on behalf
+// of the process that started the read.
+void
+bdone(struct buf *b)
+{
+  b->async = 0;
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
-
-
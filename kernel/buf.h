@@ -1,12 +1,13 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int async;   // read ahead: call bdone() when disk is done
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  struct buf *prev; // hash bucket LRU list
   struct buf *next;
-  uchar data[BSIZE];
+  uchar *data;      // BSIZE bytes, see bufalloc()
 };
 
@@ -119,8 +119,20 @@ fileread(struct file *f, uint64 addr, int n)
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
+    // a read that starts where the last one ended is
+    // sequential; read further ahead each time, up to RAMAX
+    // blocks. any other read turns readahead off again.
+    if(f->off == f->ranext && f->off > 0){
+      if(f->rawin < RAMAX)
+        f->rawin = f->rawin ? f->rawin*2 : 2;
+    } else {
+      f->rawin = 0;
+    }
+    if(f->rawin > 0)
+      ireadahead(f->ip, f->off, f->rawin);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
+    f->ranext = f->off;
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -129,6 +141,27 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Writes to an inode go in chunks of as many blocks as fit in
+// the largest log transaction. Each chunk reserves its blocks
+// plus at worst an allocation block each, the i-node, two
+// extent blocks and the doubly-indirect block and their
+// allocation blocks, and 2 blocks of slop for a non-aligned
+// write.
+
+// The most bytes to write in one transaction.
+static int
+writechunk(void)
+{
+  return ((logmaxop()-1-6-2) / 2) * BSIZE;
+}
+
+// How many log blocks writing n bytes in one transaction needs.
+static int
+writeblocks(int n)
+{
+  return 2*((n + BSIZE - 1) / BSIZE) + 1+6+2;
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
@@ -146,23 +179,20 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int max = writechunk();
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
+      int nlog = writeblocks(n1);
 
-      begin_op();
+      begin_opn(nlog);
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      end_opn(nlog);
 
       if(r != n1){
         // error from writei
@@ -178,3 +208,64 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Move up to n bytes from f to g, one a file and the other a
+// pipe, copying straight between the buffer cache and the
+// pipe's buffer rather than through user memory. Returns when
+// n bytes have moved, or at end of file, with how many did,
+// or -1 if none did because of an error.
+int
+filesplice(struct file *f, struct file *g, int n)
+{
+  int m, r = 0, tot = 0;
+  char *p;
+
+  if(f->readable == 0 || g->writable == 0)
+    return -1;
+
+  if(f->type == FD_INODE && g->type == FD_PIPE){
+    while(tot < n){
+      if((p = pipewbegin(g->pipe, n - tot, &m)) == 0){
+        r = -1;
+        break;
+      }
+      ilock(f->ip);
+      if((r = readi(f->ip, 0, (uint64)p, f->off, m)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+      pipewend(g->pipe, r > 0 ? r : 0);
+      if(r <= 0)
+        break;
+      tot += r;
+    }
+  } else if(f->type == FD_PIPE && g->type == FD_INODE){
+    // as much at a time as filewrite() writes in one transaction.
+    int max = writechunk();
+    while(tot < n){
+      if((p = piperbegin(f->pipe, n - tot < max ? n - tot : max, &m)) == 0){
+        r = -1;
+        break;
+      }
+      if(m == 0){
+        piperend(f->pipe, 0);
+        break;
+      }
+      int nlog = writeblocks(m);
+      begin_opn(nlog);
+      ilock(g->ip);
+      if((r = writei(g->ip, 0, (uint64)p, g->off, m)) > 0)
+        g->off += r;
+      iunlock(g->ip);
+      end_opn(nlog);
+      piperend(f->pipe, r > 0 ? r : 0);
+      if(r != m){
+        r = -1;
+        break;
+      }
+      tot += r;
+    }
+  } else {
+    return -1;
+  }
+
+  return tot == 0 && r < 0 ? -1 : tot;
+}
@@ -6,6 +6,8 @@ struct file {
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  uint ranext;       // FD_INODE: off after the last read
+  uint rawin;        // FD_INODE: blocks to read ahead of off
   short major;       // FD_DEVICE
 };
 
@@ -18,6 +20,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *prev; // hash bucket LRU list
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +30,13 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  ushort flags;
+  struct extent ext[NDEXTENT];
+  uint extblk;
+  uint dextblk;
+
+  struct extent hint; // copy of the extent bmap() found last,
+  uint hintbn;        // and the file block it starts at
 };
 
 // map major device number to device functions.
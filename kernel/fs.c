@@ -37,6 +37,69 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+// Is bit bi of bitmap buffer bp clear, its block free?
+#define BFREE(bp, bi) (((bp)->data[(bi)/8] & (1 << ((bi) % 8))) == 0)
+
+// Free space summary: for each bitmap block, how many of the
+// blocks it covers are free, and the first that may be; and the
+// same for the dinodes in each inode block. Lets ballocn() and
+// ialloc() skip full bitmap and inode blocks without reading
+// them, and the full start of the others. The entry for a block
+// is protected by the lock on that block's buffer; a look
+// without the lock is only a hint.
+struct fsum {
+  int nfree;
+  int first;
+};
+
+static struct fsum *bsum;  // one per bitmap block
+static struct fsum *isum;  // one per inode block
+static int nbsum, nisum;
+static int irotor;         // inode block ialloc() tries first
+
+static void
+fsuminit(int dev)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  int i, bi, inum;
+
+  nbsum = (sb.size + BPB - 1) / BPB;
+  nisum = (sb.ninodes + IPB - 1) / IPB;
+  if((nbsum + nisum) * sizeof(struct fsum) > PGSIZE)
+    panic("fsuminit: file system too big");
+  if((bsum = (struct fsum*)kalloc()) == 0)
+    panic("fsuminit: kalloc");
+  isum = bsum + nbsum;
+
+  for(i = 0; i < nbsum; i++){
+    bp = bread(dev, BBLOCK(i*BPB, sb));
+    bsum[i].nfree = 0;
+    bsum[i].first = BPB;
+    for(bi = 0; bi < BPB && i*BPB + bi < sb.size; bi++){
+      if(BFREE(bp, bi)){
+        if(bsum[i].nfree++ == 0)
+          bsum[i].first = bi;
+      }
+    }
+    brelse(bp);
+  }
+
+  for(i = 0; i < nisum; i++){
+    bp = bread(dev, sb.inodestart + i);
+    isum[i].nfree = 0;
+    isum[i].first = IPB;
+    for(inum = i*IPB; inum < (i+1)*IPB && inum < sb.ninodes; inum++){
+      dip = (struct dinode*)bp->data + inum%IPB;
+      if(inum > 0 && dip->type == 0){
+        if(isum[i].nfree++ == 0)
+          isum[i].first = inum%IPB;
+      }
+    }
+    brelse(bp);
+  }
+}
+
 // Init fs
 void
 fsinit(int dev) {
@@ -44,41 +107,71 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  readsb(dev, &sb);  // recovery may have changed the orphan list
+  fsuminit(dev);
   ireclaim(dev);
 }
 
-// Zero a block.
+// Zero a block. No need to read it first.
 static void
 bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = bnew(dev, bno);
   memset(bp->data, 0, BSIZE);
+  bp->valid = 1;
   log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
+// Allocate up to *n contiguous zeroed disk blocks with one
+// bitmap update, looking first at block near and after it.
+// Sets *n to the number allocated.
+// returns the first block, or 0 if out of disk space.
 static uint
-balloc(uint dev)
+ballocn(uint dev, uint near, uint *n)
 {
-  int b, bi, m;
+  int b, bi, i, j, k, fromfirst;
   struct buf *bp;
+  uint cnt;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  if(near >= sb.size)
+    near = 0;
+
+  // look at each bitmap block with free blocks in turn,
+  // starting with near's, and at the start of near's again
+  // at the end.
+  for(i = 0; i <= nbsum; i++){
+    k = (near / BPB + i) % nbsum;
+    if(bsum[k].nfree <= 0)
+      continue;
+    b = k * BPB;
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
+    bi = bsum[k].first;
+    if(i == 0 && near % BPB > bi)
+      bi = near % BPB;
+    fromfirst = (bi == bsum[k].first);
+    for(; bi < BPB && b + bi < sb.size; bi++){
+      if(bi % 8 == 0 && bp->data[bi/8] == 0xff){
+        bi += 7;  // skip 8 blocks in use
+        continue;
+      }
+      if(BFREE(bp, bi)){
+        // mark the run of free blocks starting here in use.
+        for(cnt = 0; cnt < *n && bi + cnt < BPB && b + bi + cnt < sb.size &&
+              BFREE(bp, bi + cnt); cnt++)
+          bp->data[(bi+cnt)/8] |= 1 << ((bi+cnt) % 8);
+        bsum[k].nfree -= cnt;
+        if(fromfirst)  // all before bi in use
+          bsum[k].first = bi + cnt;
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
+        for(j = 0; j < cnt; j++)
+          bzero(dev, b + bi + j);
+        *n = cnt;
         return b + bi;
       }
     }
@@ -88,21 +181,45 @@ balloc(uint dev)
   return 0;
 }
 
+// Allocate a zeroed disk block.
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev)
+{
+  uint n = 1;
+
+  return ballocn(dev, 0, &n);
+}
+
+// Free n contiguous disk blocks, starting at block b,
+// with one update of each bitmap block they are in.
+static void
+bfreen(int dev, uint b, uint n)
+{
+  struct buf *bp;
+  uint bi;
+
+  while(n > 0){
+    bp = bread(dev, BBLOCK(b, sb));
+    struct fsum *s = &bsum[b / BPB];
+    if(b % BPB < s->first)
+      s->first = b % BPB;
+    for(bi = b % BPB; bi < BPB && n > 0; bi++, b++, n--){
+      if(BFREE(bp, bi))
+        panic("freeing free block");
+      bp->data[bi/8] &= ~(1 << (bi % 8));
+      s->nfree++;
+    }
+    log_write(bp);
+    brelse(bp);
+  }
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
 {
-  struct buf *bp;
-  int bi, m;
-
-  bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;
-  log_write(bp);
-  brelse(bp);
+  bfreen(dev, b, 1);
 }
 
 // Inodes.
@@ -120,7 +237,9 @@ bfree(int dev, uint b)
 // to provide a place for synchronizing access
 // to inodes used by multiple processes. The in-memory
 // inodes include book-keeping information that is
-// not stored on disk: ip->ref and ip->valid.
+// not stored on disk: ip->ref and ip->valid. The table
+// also keeps recently used inodes with no references, so
+// that using one again needn't read it from the disk.
 //
 // An inode and its in-memory representation go through a
 // sequence of states before they can be used by the
@@ -131,7 +250,7 @@ bfree(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
+//   can be recycled if ip->ref is zero. Otherwise ip->ref tracks
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
@@ -165,29 +284,110 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// The table is a hash table on (dev, inum), each bucket a
+// list of entries with a spin-lock, like the buffer cache.
+// A bucket's lock protects the allocation of the entries
+// on its list. Since ip->ref indicates whether an entry is
+// free, and ip->dev and ip->inum indicate which i-node an entry
+// holds, one must hold the lock of the entry's bucket while
+// using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
-struct {
+#define NIBUCKET 61      // prime
+#define ICACHEFRAC 256   // use about 1/ICACHEFRAC of free memory at boot
+
+struct ibucket {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode head;  // head.next is most recently used
+};
+
+struct {
+  struct ibucket bucket[NIBUCKET];
 } itable;
 
+int ninode;  // number of entries in the inode table, set by iinit()
+
+static void dcacheinit(void);
+static void dcachepurge(uint dev, uint dinum);
+static void iunorphan(struct inode *ip);
+
+static struct ibucket*
+ihash(uint dev, uint inum)
+{
+  return &itable.bucket[(dev * 31 + inum) % NIBUCKET];
+}
+
+// Take ip off whatever bucket list it is on.
+static void
+idetach(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+// Insert ip at the most-recently-used end of bk's list.
+static void
+ipush(struct ibucket *bk, struct inode *ip)
+{
+  ip->next = bk->head.next;
+  ip->prev = &bk->head;
+  bk->head.next->prev = ip;
+  bk->head.next = ip;
+}
+
+// Look for inode (dev, inum) in bk.
+// Caller must hold bk->lock.
+static struct inode*
+ifind(struct ibucket *bk, uint dev, uint inum)
+{
+  struct inode *ip;
+
+  for(ip = bk->head.next; ip != &bk->head; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum)
+      return ip;
+  }
+  return 0;
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
-  initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  struct ibucket *bk;
+  struct inode *ip;
+  char *p = 0;
+  int i, n = 0;
+
+  for(bk = itable.bucket; bk < itable.bucket+NIBUCKET; bk++){
+    initlock(&bk->lock, "itable");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
   }
+
+  // Size the table from the memory that is free at boot,
+  // but make it no smaller than NINODE.
+  ninode = (uint64)knfree() * PGSIZE / ICACHEFRAC / sizeof(struct inode);
+  if(ninode < NINODE)
+    ninode = NINODE;
+
+  // Spread the entries over the buckets; iget() moves them
+  // to whichever bucket needs them.
+  for(i = 0; i < ninode; i++){
+    if(n == 0){
+      if((p = kalloc()) == 0)
+        panic("iinit");
+      n = PGSIZE / sizeof(struct inode);
+    }
+    ip = (struct inode*)p;
+    p += sizeof(struct inode);
+    n--;
+    memset(ip, 0, sizeof(*ip));
+    initsleeplock(&ip->lock, "inode");
+    ipush(&itable.bucket[i % NIBUCKET], ip);
+  }
+  dcacheinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -199,19 +399,29 @@ static struct inode* iget(uint dev, uint inum);
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  int i, k, inum;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
+  // look at each inode block with free inodes in turn,
+  // starting with the one the last inode came from.
+  for(i = 0; i < nisum; i++){
+    k = (irotor + i) % nisum;
+    if(isum[k].nfree <= 0)
+      continue;
+    bp = bread(dev, sb.inodestart + k);
+    for(inum = k*IPB + isum[k].first; inum < (k+1)*IPB && inum < sb.ninodes; inum++){
+      dip = (struct dinode*)bp->data + inum%IPB;
+      if(inum > 0 && dip->type == 0){  // a free inode
+        memset(dip, 0, sizeof(*dip));
+        dip->type = type;
+        log_write(bp);   // mark it allocated on the disk
+        isum[k].nfree--;
+        isum[k].first = inum%IPB + 1;
+        irotor = k;
+        brelse(bp);
+        return iget(dev, inum);
+      }
     }
     brelse(bp);
   }
@@ -231,12 +441,22 @@ iupdate(struct inode *ip)
 
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
+  if(dip->type != 0 && ip->type == 0){
+    // iput() is freeing the inode.
+    struct fsum *s = &isum[ip->inum / IPB];
+    s->nfree++;
+    if(ip->inum % IPB < s->first)
+      s->first = ip->inum % IPB;
+  }
   dip->type = ip->type;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  dip->flags = ip->flags;
+  memmove(dip->ext, ip->ext, sizeof(ip->ext));
+  dip->extblk = ip->extblk;
+  dip->dextblk = ip->dextblk;
   log_write(bp);
   brelse(bp);
 }
@@ -247,34 +467,60 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct ibucket *bk, *vk, *lo, *hi;
+  struct inode *ip;
+  int h, i;
 
-  acquire(&itable.lock);
+  bk = ihash(dev, inum);
+  acquire(&bk->lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  if((ip = ifind(bk, dev, inum)) != 0){
+    ip->ref++;
+    release(&bk->lock);
+    return ip;
+  }
+  release(&bk->lock);
+
+  // Recycle the least recently used entry with no references,
+  // looking in this inode's own bucket first and then in the
+  // others, two bucket locks at a time in index order, as
+  // bget() does.
+  h = bk - itable.bucket;
+  for(i = 0; i < NIBUCKET; i++){
+    vk = &itable.bucket[(h + i) % NIBUCKET];
+    lo = bk < vk ? bk : vk;
+    hi = bk < vk ? vk : bk;
+    acquire(&lo->lock);
+    if(hi != lo)
+      acquire(&hi->lock);
+
+    if((ip = ifind(bk, dev, inum)) != 0){
       ip->ref++;
-      release(&itable.lock);
-      return ip;
+    } else {
+      for(ip = vk->head.prev; ip != &vk->head; ip = ip->prev){
+        if(ip->ref == 0)
+          break;
+      }
+      if(ip != &vk->head){
+        ip->dev = dev;
+        ip->inum = inum;
+        ip->ref = 1;
+        ip->valid = 0;
+        idetach(ip);
+        ipush(bk, ip);
+      } else {
+        ip = 0;
+      }
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
-  }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
-  ip->dev = dev;
-  ip->inum = inum;
-  ip->ref = 1;
-  ip->valid = 0;
-  release(&itable.lock);
-
-  return ip;
+    if(hi != lo)
+      release(&hi->lock);
+    release(&lo->lock);
+    if(ip)
+      return ip;
+  }
+  panic("iget: no inodes");
 }
 
 // Increment reference count for ip.
@@ -282,9 +528,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = ihash(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
   ip->ref++;
-  release(&itable.lock);
+  release(&bk->lock);
   return ip;
 }
 
@@ -309,7 +557,11 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    ip->flags = dip->flags;
+    memmove(ip->ext, dip->ext, sizeof(ip->ext));
+    ip->extblk = dip->extblk;
+    ip->dextblk = dip->dextblk;
+    ip->hint.len = 0;
     brelse(bp);
     ip->valid = 1;
     if(ip->type == 0)
@@ -329,7 +581,7 @@ iunlock(struct inode *ip)
 
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode table entry can
-// be recycled.
+// be recycled, least recently used first.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -337,7 +589,11 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  // ip's identity can't change while ip->ref > 0,
+  // so its bucket is stable until ref drops below.
+  struct ibucket *bk = ihash(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -346,20 +602,28 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
+    release(&bk->lock);
 
+    if(ip->type == T_DIR)
+      dcachepurge(ip->dev, ip->inum);
     itrunc(ip);
+    if(ip->flags & D_ORPHAN)
+      iunorphan(ip);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquire(&bk->lock);
   }
 
   ip->ref--;
-  release(&itable.lock);
+  if(ip->ref == 0){
+    idetach(ip);
+    ipush(bk, ip);
+  }
+  release(&bk->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -370,34 +634,255 @@ iunlockput(struct inode *ip)
   iput(ip);
 }
 
+// The orphan list.
+//
+// An inode whose last link is removed while it is still open
+// is an orphan: iput() frees it when the last reference goes,
+// which a crash may prevent. So that recovery need not look
+// at every inode for orphans, unlink puts such an inode on a
+// list, whose head is in the superblock and which is linked
+// through dinode.orphan, in the same transaction that clears
+// nlink; iput() takes it off in the transaction that frees it.
+// D_ORPHAN in the inode's flags says it is on the list.
+// orphanlock protects the list and sb.orphan.
+
+static struct sleeplock orphanlock;
+
+// Set the head of the orphan list, in memory and on disk.
+static void
+setorphan(uint dev, uint inum)
+{
+  struct buf *bp;
+
+  sb.orphan = inum;
+  bp = bread(dev, 1);
+  ((struct superblock*)bp->data)->orphan = inum;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Add ip to the orphan list.
+// Caller must hold ip->lock and be in a transaction.
 void
-ireclaim(int dev)
+iorphan(struct inode *ip)
 {
-  for (int inum = 1; inum < sb.ninodes; inum++) {
-    struct inode *ip = 0;
-    struct buf *bp = bread(dev, IBLOCK(inum, sb));
-    struct dinode *dip = (struct dinode *)bp->data + inum % IPB;
-    if (dip->type != 0 && dip->nlink == 0) {  // is an orphaned inode
-      printf("ireclaim: orphaned inode %d\n", inum);
-      ip = iget(dev, inum);
-    }
-    brelse(bp);
-    if (ip) {
-      begin_op();
-      ilock(ip);
-      iunlock(ip);
-      iput(ip);
-      end_op();
+  struct buf *bp;
+  struct dinode *dip;
+
+  if(ip->flags & D_ORPHAN)
+    return;
+  acquiresleep(&orphanlock);
+  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  dip = (struct dinode*)bp->data + ip->inum%IPB;
+  dip->orphan = sb.orphan;
+  ip->flags |= D_ORPHAN;
+  dip->flags = ip->flags;
+  log_write(bp);
+  brelse(bp);
+  setorphan(ip->dev, ip->inum);
+  releasesleep(&orphanlock);
+}
+
+// Take ip off the orphan list. The list is short, and ip
+// was likely added last, so it is likely at the head.
+// Caller must hold ip->lock and be in a transaction.
+static void
+iunorphan(struct inode *ip)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  uint inum, next, link;
+
+  acquiresleep(&orphanlock);
+  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  dip = (struct dinode*)bp->data + ip->inum%IPB;
+  next = dip->orphan;
+  dip->orphan = 0;
+  ip->flags &= ~D_ORPHAN;
+  dip->flags = ip->flags;
+  log_write(bp);
+  brelse(bp);
+
+  if(sb.orphan == ip->inum){
+    setorphan(ip->dev, next);
+  } else {
+    for(inum = sb.orphan; inum != 0; inum = link){
+      bp = bread(ip->dev, IBLOCK(inum, sb));
+      dip = (struct dinode*)bp->data + inum%IPB;
+      link = dip->orphan;
+      if(link == ip->inum){
+        dip->orphan = next;
+        log_write(bp);
+        brelse(bp);
+        break;
+      }
+      brelse(bp);
     }
   }
+  releasesleep(&orphanlock);
+}
+
+// Free the inodes on the orphan list, left by a crash.
+void
+ireclaim(int dev)
+{
+  struct inode *ip;
+
+  initsleeplock(&orphanlock, "orphan");
+  while(sb.orphan != 0){
+    printf("ireclaim: orphaned inode %d\n", sb.orphan);
+    ip = iget(dev, sb.orphan);
+    begin_op();
+    ilock(ip);
+    // iput() frees ip, and takes it off the list, unless it is
+    // not an orphan after all.
+    if(ip->nlink != 0 || (ip->flags & D_ORPHAN) == 0)
+      iunorphan(ip);
+    iunlock(ip);
+    iput(ip);
+    end_op();
+  }
 }
 
 // Inode content
 //
 // The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// in blocks on the disk, described by a list of extents,
+// each a run of contiguous blocks, in file order. The first
+// NDEXTENT extents are in ip->ext[]. The next NIEXTENT are
+// in the extent block ip->extblk. The rest are in the extent
+// blocks listed in the doubly-indirect block ip->dextblk.
+// Extents after the last one used have len 0. Files have no
+// holes, so a file's blocks are always the first blocks its
+// extents describe.
+
+// Look for file block bn in the n extents in e, the first of
+// which starts at file block *base. Returns bn's disk block,
+// remembering the extent in ip->hint, or 0 with *base moved
+// past the extents in use and *used set to how many are.
+static uint
+extfind(struct inode *ip, struct extent *e, int n, uint *base, uint bn, int *used)
+{
+  int i;
+
+  for(i = 0; i < n && e[i].len > 0; i++){
+    if(bn - *base < e[i].len){
+      ip->hint = e[i];
+      ip->hintbn = *base;
+      return e[i].start + (bn - *base);
+    }
+    *base += e[i].len;
+  }
+  *used = i;
+  return 0;
+}
+
+// Like bmapset(), for the extents in the extent block *blk,
+// the first of which starts at file block *base. Allocates
+// the extent block if appending and *blk is 0. If bn isn't
+// mapped, moves *base past the extents and sets *more if
+// they are all in use, so bn may be in a later block.
+static uint
+extblkmap(struct inode *ip, uint *blk, uint *base, uint bn, uint addr, int *more)
+{
+  struct buf *bp;
+  struct extent *a;
+  uint x;
+  int n;
+
+  *more = 0;
+  if(*blk == 0){
+    if(addr == 0 || bn != *base)
+      return 0;
+    if((*blk = balloc(ip->dev)) == 0)
+      return 0;
+  }
+  bp = bread(ip->dev, *blk);
+  a = (struct extent*)bp->data;
+  if((x = extfind(ip, a, NIEXTENT, base, bn, &n)) == 0){
+    if(addr != 0 && bn == *base){
+      if(n > 0 && a[n-1].start + a[n-1].len == addr){
+        a[n-1].len++;
+        x = addr;
+      } else if(n < NIEXTENT){
+        a[n].start = addr;
+        a[n].len = 1;
+        x = addr;
+      }
+      if(x)
+        log_write(bp);
+    }
+    *more = (x == 0 && n == NIEXTENT);
+  }
+  brelse(bp);
+  return x;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block and addr is not 0, make addr the
+// nth block, which must be just past the end of the file,
+// by growing the last extent or starting a new one.
+// returns 0 if there is no block and addr is 0, or if out of
+// extents, or out of disk space for an extent block.
+static uint
+bmapset(struct inode *ip, uint bn, uint addr)
+{
+  struct buf *bp;
+  uint base, x, blk, *a;
+  int i, n, more;
+
+  if(bn >= MAXFILE)
+    panic("bmap: out of range");
+
+  // the extent that held the last block looked up
+  // usually holds this one too.
+  if(bn - ip->hintbn < ip->hint.len)
+    return ip->hint.start + (bn - ip->hintbn);
+
+  // Extents in the inode.
+  base = 0;
+  if((x = extfind(ip, ip->ext, NDEXTENT, &base, bn, &n)) != 0)
+    return x;
+  if(n < NDEXTENT || ip->extblk == 0){
+    if(addr == 0 || bn != base)
+      return 0;
+    if(n > 0 && ip->ext[n-1].start + ip->ext[n-1].len == addr){
+      ip->ext[n-1].len++;
+      return addr;
+    }
+    if(n < NDEXTENT){
+      ip->ext[n].start = addr;
+      ip->ext[n].len = 1;
+      return addr;
+    }
+  }
+
+  // Extents in the extent block.
+  if((x = extblkmap(ip, &ip->extblk, &base, bn, addr, &more)) != 0 || !more)
+    return x;
+
+  // Extents in the blocks listed in the doubly-indirect block.
+  if(ip->dextblk == 0){
+    if(addr == 0 || bn != base)
+      return 0;
+    if((ip->dextblk = balloc(ip->dev)) == 0)
+      return 0;
+  }
+  bp = bread(ip->dev, ip->dextblk);
+  a = (uint*)bp->data;
+  for(i = 0; i < NDINDIRECT; i++){
+    blk = a[i];
+    x = extblkmap(ip, &blk, &base, bn, addr, &more);
+    if(blk != a[i]){
+      a[i] = blk;
+      log_write(bp);
+    }
+    if(x != 0 || !more)
+      break;
+  }
+  brelse(bp);
+  return x;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -405,42 +890,67 @@ ireclaim(int dev)
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr;
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[bn] = addr;
-    }
+  if((addr = bmapset(ip, bn, 0)) != 0)
     return addr;
+  if((addr = balloc(ip->dev)) == 0)
+    return 0;
+  if(bmapset(ip, bn, addr) != addr){
+    bfree(ip->dev, addr);
+    return 0;
   }
-  bn -= NDIRECT;
+  return addr;
+}
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
+// Make sure blocks bn up to nb of inode ip have disk blocks,
+// allocating the missing ones as runs of contiguous blocks,
+// with one bitmap update per run, right after the file's
+// previous block if possible. Stops early if out of disk
+// space, leaving bmap() to report it.
+static void
+ibextend(struct inode *ip, uint bn, uint nb)
+{
+  uint addr, prev, n, i;
+
+  prev = bn > 0 ? bmapset(ip, bn-1, 0) : 0;
+  while(bn < nb){
+    if((addr = bmapset(ip, bn, 0)) != 0){
+      prev = addr;
+      bn++;
+      continue;
     }
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
+    n = nb - bn;
+    if((addr = ballocn(ip->dev, prev ? prev+1 : 0, &n)) == 0)
+      return;
+    for(i = 0; i < n; i++, bn++){
+      if(bmapset(ip, bn, addr+i) != addr+i){
+        for(; i < n; i++)
+          bfree(ip->dev, addr+i);
+        return;
       }
     }
-    brelse(bp);
-    return addr;
+    prev = addr + n - 1;
   }
+}
 
-  panic("bmap: out of range");
+// Free the blocks of the extents in extent block blk,
+// and blk itself.
+static void
+extblkfree(uint dev, uint blk)
+{
+  struct buf *bp;
+  struct extent *a;
+  int i;
+
+  bp = bread(dev, blk);
+  a = (struct extent*)bp->data;
+  for(i = 0; i < NIEXTENT; i++){
+    if(a[i].len)
+      bfreen(dev, a[i].start, a[i].len);
+  }
+  brelse(bp);
+  bfree(dev, blk);
 }
 
 // Truncate inode (discard contents).
@@ -448,29 +958,36 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
   struct buf *bp;
   uint *a;
+  int i;
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
+  for(i = 0; i < NDEXTENT; i++){
+    if(ip->ext[i].len){
+      bfreen(ip->dev, ip->ext[i].start, ip->ext[i].len);
+      ip->ext[i].start = 0;
+      ip->ext[i].len = 0;
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+  if(ip->extblk){
+    extblkfree(ip->dev, ip->extblk);
+    ip->extblk = 0;
+  }
+
+  if(ip->dextblk){
+    bp = bread(ip->dev, ip->dextblk);
     a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+    for(i = 0; i < NDINDIRECT; i++){
+      if(a[i])
+        extblkfree(ip->dev, a[i]);
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    bfree(ip->dev, ip->dextblk);
+    ip->dextblk = 0;
   }
 
+  ip->hint.len = 0;
   ip->size = 0;
   iupdate(ip);
 }
@@ -518,6 +1035,25 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Start reading up to n blocks of ip, beginning with the
+// block that holds offset off, so that later readi() calls
+// find them in the buffer cache. Doesn't wait for the disk.
+// Caller must hold ip->lock.
+void
+ireadahead(struct inode *ip, uint off, uint n)
+{
+  uint blocknos[RAMAX];
+  uint bn, i;
+
+  if(n > RAMAX)
+    n = RAMAX;
+  for(i = 0, bn = off/BSIZE; i < n && bn*BSIZE < ip->size; i++, bn++){
+    if((blocknos[i] = bmap(ip, bn)) == 0)
+      break;
+  }
+  breadahead(ip->dev, blocknos, i);
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -536,16 +1072,22 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  ibextend(ip, off/BSIZE, (off + n + BSIZE - 1)/BSIZE);
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
-    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(m == BSIZE)
+      bp = bnew(ip->dev, addr);  // all of it is overwritten
+    else
+      bp = bread(ip->dev, addr);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
       break;
     }
+    bp->valid = 1;
     log_write(bp);
     brelse(bp);
   }
@@ -554,8 +1096,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     ip->size = off;
 
   // write the i-node back to disk even if the size didn't change
-  // because the loop above might have called bmap() and added a new
-  // block to ip->addrs[].
+  // because ibextend() or bmap() might have added a new block
+  // to ip->ext[].
   iupdate(ip);
 
   return tot;
@@ -569,32 +1111,317 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory name cache.
+//
+// dirlookup() remembers what it finds, keyed by (directory,
+// name): the entry's inode number and offset, or inum 0 if
+// the directory has no entry with that name. Later lookups
+// of the same name then need not read the directory.
+// Whoever adds or removes a directory entry updates the
+// cache with dcacheset() while holding the directory's lock,
+// as dirlink() and sys_unlink() do; iput() drops the entries
+// of a directory it frees, since its inum may be reused.
+// dcache.lock protects the table; the least recently used
+// entry is the one replaced.
+
+#define NDHASH 61
+
+struct dentry {
+  uint dev;
+  uint dinum;          // directory's inode number; 0 if unused
+  char name[DIRSIZ];
+  uint inum;           // inode number of entry; 0 if none
+  uint off;            // byte offset of entry in directory
+  struct dentry *hnext;  // hash chain
+  struct dentry *prev;   // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *hash[NDHASH];
+  struct dentry head;  // head.next is most recently used
+} dcache;
+
+static void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+static struct dentry**
+dhash(uint dev, uint dinum, char *name)
+{
+  uint h = dev*31 + dinum;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + name[i];
+  return &dcache.hash[h % NDHASH];
+}
+
+// Find the entry for (dev, dinum, name), making it the most
+// recently used. Caller must hold dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dinum, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dhash(dev, dinum, name); d; d = d->hnext){
+    if(d->dev == dev && d->dinum == dinum && namecmp(d->name, name) == 0){
+      d->next->prev = d->prev;
+      d->prev->next = d->next;
+      d->next = dcache.head.next;
+      d->prev = &dcache.head;
+      dcache.head.next->prev = d;
+      dcache.head.next = d;
+      return d;
+    }
+  }
+  return 0;
+}
+
+// Take d off its hash chain and make it unused.
+// Caller must hold dcache.lock.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  if(d->dinum == 0)
+    return;
+  for(pp = dhash(d->dev, d->dinum, d->name); *pp != d; pp = &(*pp)->hnext)
+    ;
+  *pp = d->hnext;
+  d->dinum = 0;
+}
+
+// Look up name in directory dp in the cache. If it's there,
+// set *inum and *off (*inum is 0 if dp has no such entry)
+// and return 1. Caller must hold dp->lock.
+static int
+dcacheget(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) != 0){
+    *inum = d->inum;
+    *off = d->off;
+  }
+  release(&dcache.lock);
+  return d != 0;
+}
+
+// Record that name in directory dp is the entry at offset off
+// for inode inum, or with inum 0, that dp has no such entry.
+// Caller must hold dp->lock.
+void
+dcacheset(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d, **hp;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    // Recycle the least recently used entry.
+    d = dcache.head.prev;
+    dunhash(d);
+    d->dev = dp->dev;
+    d->dinum = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    hp = dhash(d->dev, d->dinum, d->name);
+    d->hnext = *hp;
+    *hp = d;
+    dfind(d->dev, d->dinum, d->name);  // most recently used
+  }
+  d->inum = inum;
+  d->off = off;
+  release(&dcache.lock);
+}
+
+// Forget the entries of directory dinum, which is being freed.
+static void
+dcachepurge(uint dev, uint dinum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    if(d->dev == dev && d->dinum == dinum)
+      dunhash(d);
+  }
+  release(&dcache.lock);
+}
+
+// Hashed directories.
+//
+// A directory with D_HASHED in its flags (mkfs makes the root
+// one, and create() every other) is a hash table of dirents
+// with NHBUCKET buckets, each a chain of blocks. Block 0 is the
+// bucket table, giving the file block number of each bucket's
+// first block, or 0 if it has none yet. The last slot of each
+// bucket block gives the number of the bucket's next block, or
+// 0. The entry for a name is in bucket dirhash(name), in the
+// slot that was free when the entry was made; a bucket with no
+// free slot grows by a block at the end of the directory. A
+// lookup reads the table and then just the name's bucket.
+
+static uint
+dirhash(char *name)
+{
+  uint h = 2166136261;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h % NHBUCKET;
+}
+
+// Where block bn of a hashed directory, held in bp, points to
+// the next block of bucket h: the table entry if bn is 0,
+// the block's last slot otherwise.
+static uint*
+hdirnext(struct buf *bp, uint bn, uint h)
+{
+  struct dirptr *p = (struct dirptr*)bp->data;
+
+  if(bn == 0)
+    return &p[h/3].bn[h%3];
+  return &p[DPB-1].bn[0];
+}
+
+// Look for name in hashed directory dp. If found, return its
+// inum and set *poff to its offset. Otherwise return 0, set
+// *poff to the first free slot in name's bucket, or to dp->size
+// if there is none, and set *ptail to the bucket's last block,
+// or to 0 if it has none.
+static uint
+hdirfind(struct inode *dp, char *name, uint *poff, uint *ptail)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint h, bn, next, j, inum;
+
+  h = dirhash(name);
+  *poff = dp->size;
+  for(bn = 0; ; bn = next){
+    bp = bread(dp->dev, bmap(dp, bn));
+    de = (struct dirent*)bp->data;
+    for(j = 0; bn != 0 && j < DPB-1; j++){
+      if(de[j].inum == 0){
+        if(*poff == dp->size)
+          *poff = bn*BSIZE + j*sizeof(*de);
+      } else if(namecmp(name, de[j].name) == 0){
+        inum = de[j].inum;
+        brelse(bp);
+        *poff = bn*BSIZE + j*sizeof(*de);
+        return inum;
+      }
+    }
+    next = *hdirnext(bp, bn, h);
+    brelse(bp);
+    if(next == 0)
+      break;
+    if(next <= bn || next >= dp->size/BSIZE)  // blocks link forward
+      panic("hdirfind");
+  }
+  *ptail = bn;
+  return 0;
+}
+
+// Add a block to the end of hashed directory dp and link it
+// after block tail of name's bucket. Returns the offset of its
+// first slot, or 0 if out of disk space.
+static uint
+hdirgrow(struct inode *dp, char *name, uint tail)
+{
+  struct buf *bp;
+  uint bn;
+
+  bn = dp->size / BSIZE;
+  if(bmap(dp, bn) == 0)  // a zeroed block
+    return 0;
+  dp->size += BSIZE;
+  iupdate(dp);
+
+  bp = bread(dp->dev, bmap(dp, tail));
+  *hdirnext(bp, tail, dirhash(name)) = bn;
+  log_write(bp);
+  brelse(bp);
+  return bn*BSIZE;
+}
+
+// Make the new, empty directory dp a hashed one,
+// with an empty bucket table.
+// Returns 0 on success, -1 if out of disk space.
+int
+hdirinit(struct inode *dp)
+{
+  if(dp->size != 0)
+    panic("hdirinit");
+  if(bmap(dp, 0) == 0)
+    return -1;
+  dp->size = BSIZE;
+  dp->flags |= D_HASHED;
+  iupdate(dp);
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off, inum, tail;
   struct dirent de;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  if(dcacheget(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  inum = 0;
+  if(dp->flags & D_HASHED){
+    inum = hdirfind(dp, name, &off, &tail);
+  } else {
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlookup read");
+      if(de.inum == 0)
+        continue;
+      if(namecmp(name, de.name) == 0){
+        inum = de.inum;
+        break;
+      }
     }
   }
 
-  return 0;
+  if(inum == 0){
+    dcacheset(dp, name, 0, 0);
+    return 0;
+  }
+  // entry matches path element
+  if(poff)
+    *poff = off;
+  dcacheset(dp, name, inum, off);
+  return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -602,7 +1429,7 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  uint off, tail;
   struct dirent de;
   struct inode *ip;
 
@@ -613,17 +1440,24 @@ dirlink(struct inode *dp, char *name, uint inum)
   }
 
   // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  if(dp->flags & D_HASHED){
+    hdirfind(dp, name, &off, &tail);
+    if(off == dp->size && (off = hdirgrow(dp, name, tail)) == 0)
+      return -1;
+  } else {
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink read");
+      if(de.inum == 0)
+        break;
+    }
   }
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcacheset(dp, name, inum, off);
 
   return 0;
 }
@@ -20,13 +20,26 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint orphan;       // First inode on the orphan list, or 0
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
-#define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+// Most data blocks the log can hold: one header block
+// names them all, with a checksum of each (see log.c).
+#define MAXLOGBLOCKS ((BSIZE / sizeof(uint) - 3) / 2)
+
+// A run of len contiguous disk blocks, starting at block start.
+struct extent {
+  uint start;
+  uint len;
+};
+
+#define NDEXTENT 5                                 // extents in the inode
+#define NIEXTENT (BSIZE / sizeof(struct extent))   // extents in an extent block
+#define NDINDIRECT (BSIZE / sizeof(uint))          // extent blocks in the doubly-indirect block
+#define NEXTENT (NDEXTENT + NIEXTENT + NDINDIRECT*NIEXTENT)
+#define MAXFILE (1 << 20)   // max blocks in a file, if it has few enough extents
 
 // On-disk inode structure
 struct dinode {
@@ -35,9 +48,16 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  struct extent ext[NDEXTENT];  // Data blocks, in file order
+  uint extblk;          // Extent block holding the next NIEXTENT extents
+  uint dextblk;         // Doubly-indirect block, listing extent blocks
+  ushort flags;         // D_HASHED, D_ORPHAN
+  ushort orphan;        // Next inode on the orphan list, or 0
 };
 
+#define D_HASHED 0x1    // directory is a hash table of dirents (see fs.c)
+#define D_ORPHAN 0x2    // inode is on the orphan list
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -60,3 +80,19 @@ struct dirent {
   char name[DIRSIZ] __attribute__((nonstring));
 };
 
+// Dirents per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// In a hashed directory (see fs.c), the bucket table and the
+// links between a bucket's blocks are kept in dirent-sized
+// slots with inum 0, so that readers that skip free dirents
+// see only names.
+struct dirptr {
+  ushort inum;          // Always 0
+  ushort pad;
+  uint bn[3];           // File block numbers
+};
+
+// Buckets in a hashed directory: three per slot of block 0.
+#define NHBUCKET      (DPB*3)
+
@@ -18,15 +18,30 @@ struct run {
   struct run *next;
 };
 
-struct {
+// Reference counts for physical pages. A page mapped
+// copy-on-write by several processes after fork() has a
+// count greater than one, and kfree() only frees it when
+// the last reference goes away. Updated with atomic
+// instructions so that no lock is shared between CPUs.
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+static int refcnt[(PHYSTOP - KERNBASE) / PGSIZE];
+
+// Each CPU has its own free list, so that allocation on
+// different CPUs does not contend for one lock. A CPU whose
+// list is empty steals a batch of pages from another CPU.
+#define NSTEAL 32  // max pages moved by one steal
+
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;
+} kmem[NCPU];
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,12 +50,15 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    refcnt[PA2REF(p)] = 1;
     kfree(p);
+  }
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
+// Drop a reference to the page of physical memory pointed
+// at by pa, and free it if that was the last reference.
+// pa normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
 void
@@ -51,15 +69,62 @@ kfree(void *pa)
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  int n = __sync_sub_and_fetch(&refcnt[PA2REF(pa)], 1);
+  if(n < 0)
+    panic("kfree: refcnt");
+  if(n > 0)
+    return;
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  struct kmem *km = &kmem[cpuid()];
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
+  release(&km->lock);
+  pop_off();
+}
+
+// Move up to half of another CPU's free pages, at most NSTEAL,
+// to km. Only one kmem lock is held at a time.
+// Returns the number of pages moved.
+static int
+ksteal(struct kmem *km)
+{
+  struct kmem *victim;
+  struct run *first, *last;
+  int i, n;
+
+  for(i = 1; i < NCPU; i++){
+    victim = &kmem[((km - kmem) + i) % NCPU];
+    acquire(&victim->lock);
+    n = (victim->nfree + 1) / 2;
+    if(n > NSTEAL)
+      n = NSTEAL;
+    first = last = victim->freelist;
+    if(n > 0){
+      for(int j = 1; j < n; j++)
+        last = last->next;
+      victim->freelist = last->next;
+      victim->nfree -= n;
+    }
+    release(&victim->lock);
+
+    if(n > 0){
+      acquire(&km->lock);
+      last->next = km->freelist;
+      km->freelist = first;
+      km->nfree += n;
+      release(&km->lock);
+      return n;
+    }
+  }
+  return 0;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -70,13 +135,56 @@ kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  struct kmem *km = &kmem[cpuid()];
+  do {
+    acquire(&km->lock);
+    r = km->freelist;
+    if(r){
+      km->freelist = r->next;
+      km->nfree--;
+    }
+    release(&km->lock);
+  } while(r == 0 && ksteal(km) > 0);
+  pop_off();
 
-  if(r)
+  if(r){
     memset((char*)r, 5, PGSIZE); // fill with junk
+    refcnt[PA2REF(r)] = 1;
+  }
   return (void*)r;
 }
+
+// Add a reference to the allocated page pa,
+// e.g. when fork() shares it copy-on-write.
+void
+kref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kref");
+  if(__sync_fetch_and_add(&refcnt[PA2REF(pa)], 1) < 1)
+    panic("kref: free page");
+}
+
+// Return the number of references to the allocated page pa.
+int
+krefcnt(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("krefcnt");
+  return __atomic_load_n(&refcnt[PA2REF(pa)], __ATOMIC_SEQ_CST);
+}
+
+// Return the number of free pages.
+int
+knfree(void)
+{
+  int n = 0;
+
+  for(int i = 0; i < NCPU; i++){
+    acquire(&kmem[i].lock);
+    n += kmem[i].nfree;
+    release(&kmem[i].lock);
+  }
+  return n;
+}
@@ -20,145 +20,385 @@
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
+// begin_op() reserves MAXOPBLOCKS log blocks; a system call
+// that may write more, like a large write(), reserves what
+// it needs with begin_opn()/end_opn().
+//
+// With COMMITTICKS > 0, the last end_op() does not commit:
+// the transaction stays open for later system calls to join,
+// so that many small writes share one commit, until a kernel
+// thread commits it every COMMITTICKS ticks, begin_op() needs
+// the log space, or fsync() calls log_sync(). A crash loses
+// the open transaction, but the file system stays consistent.
+//
+// Group commit: a commit first copies the transaction's
+// blocks out of the buffer cache into the log's own buffers,
+// which takes no disk I/O. Only during that copy must
+// begin_op() wait. While the copies are written to the log,
+// new FS system calls gather in the next transaction. If that
+// transaction has finished by the time the disk writes are
+// done, the same committer commits it too; its end_op()
+// callers don't wait.
+//
+// Checkpointing: a commit appends its blocks to the log and
+// leaves them there, and in the buffer cache, pinned. Blocks
+// that every transaction changes, like the bitmap and inode
+// blocks of a growing file, are then written to their home
+// locations once per checkpoint, not once per commit. A
+// checkpoint installs the latest logged copy of each block and
+// empties the log; it happens when the next commit would not
+// fit.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+//   header block 0
+//   header block 1
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// A header names the logged blocks A, B, C, ... in the order
+// they were logged; a block may appear more than once, and
+// the last copy is the one to install. Headers hold a sequence
+// number, a checksum of each block and one of themselves, and
+// each write of the header goes to the other header block than
+// the last. A commit writes its blocks after the ones already
+// logged, and a new header, as one batch, in no particular
+// order. If a crash leaves any of them unwritten, recovery
+// finds a checksum that does not match and uses the other,
+// older header, whose blocks the batch did not touch. All the
+// blocks of an install also go to the disk driver as one batch.
 
-// Contents of the header block, used for both the on-disk header block
+// Contents of a header block, used for both the on-disk header blocks
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGBLOCKS];
+  uint seq;                 // the current header has the larger seq
+  uint sum;                 // checksum of n, seq, block[] and bsum[]
+  int block[MAXLOGBLOCKS];
+  uint bsum[MAXLOGBLOCKS];  // checksum of each logged block
 };
 
 struct log {
   struct spinlock lock;
   int start;
+  int size;        // data blocks a transaction may use.
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks reserved by executing FS sys calls.
+  int committing;  // a commit is in progress.
+  int copying;     // commit is copying blocks from the cache, please wait.
+  int want;        // commit once no FS sys calls are executing.
+  uint seq;        // number of the open transaction.
+  uint done;       // number of the last transaction to commit.
   int dev;
-  struct logheader lh;
+  struct logheader lh;  // the open transaction
 };
 struct log log;
 
+// The current header, and the contents of the on-disk log:
+// header block i in lbuf[i], and logged block i in lbuf[i+2].
+// Only the committing process (or recovery) uses these. The
+// log buffers are not part of the buffer cache.
+static struct logheader clh;
+static struct buf **lbuf;
+static int nlbuf;
+static struct buf *batch[MAXLOGBLOCKS+1];  // for write_bufs()
+
 static void recover_from_log(void);
 static void commit();
+static void logflusher(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
+
+  // mkfs chose the size of the log. Use less of it if the
+  // buffer cache could not hold the pinned blocks of both the
+  // logged transactions and the next one, but have a log
+  // buffer for every slot, in case recovery needs them.
+  if (sb->nlog - 2 > MAXLOGBLOCKS)
+    panic("initlog: log too big");
+  log.size = sb->nlog - 2;
+  if (log.size > nbuf / 4)
+    log.size = nbuf / 4;
+  if (log.size < 2*MAXOPBLOCKS)
+    panic("initlog: log too small");
+  if ((lbuf = (struct buf **) kalloc()) == 0)
+    panic("initlog: kalloc");
+  nlbuf = sb->nlog;
+  for (int i = 0; i < nlbuf; i++) {
+    if ((lbuf[i] = bufalloc()) == 0)
+      panic("initlog: bufalloc");
+    lbuf[i]->dev = dev;
+  }
+  lbuf[0]->blockno = sb->logstart;
+  lbuf[1]->blockno = sb->logstart + 1;
+
   log.start = sb->logstart;
   log.dev = dev;
+  log.seq = 1;
   recover_from_log();
+  if (COMMITTICKS > 0)
+    kproc(logflusher, "logflusher");
+}
+
+#define CKSEED 2166136261U
+
+// FNV-1a, a word at a time, of the n bytes at p, continuing
+// from h.
+static uint
+cksum(uint h, void *p, int n)
+{
+  uint *w = (uint *) p;
+
+  for (int i = 0; i < n / sizeof(uint); i++)
+    h = (h ^ w[i]) * 16777619;
+  return h;
+}
+
+static uint
+headsum(struct logheader *lh)
+{
+  uint h;
+
+  h = cksum(CKSEED, &lh->n, sizeof(lh->n));
+  h = cksum(h, &lh->seq, sizeof(lh->seq));
+  h = cksum(h, lh->block, lh->n * sizeof(lh->block[0]));
+  return cksum(h, lh->bsum, lh->n * sizeof(lh->bsum[0]));
 }
 
-// Copy committed blocks from log to their home location
+// Write the n log buffers in bs to the disk blocks named by
+// their blocknos, as one batch.
+static void
+write_bufs(struct buf **bs, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    acquiresleep(&bs[i]->lock);
+  bwritev(bs, n);
+  for (i = 0; i < n; i++)
+    releasesleep(&bs[i]->lock);
+}
+
+// Copy the latest logged copy of each block from the log
+// buffers to its home location.
 static void
 install_trans(int recovering)
 {
-  int tail;
+  int tail, j, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    if(recovering) {
-      printf("recovering tail %d dst %d\n", tail, log.lh.block[tail]);
+  n = 0;
+  for (tail = clh.n - 1; tail >= 0; tail--) {
+    for (j = tail + 1; j < clh.n; j++) {
+      if (clh.block[j] == clh.block[tail])
+        break;
+    }
+    if (j == clh.n) {  // no later copy
+      lbuf[tail+2]->blockno = clh.block[tail];
+      batch[n++] = lbuf[tail+2];
     }
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
+  }
+  write_bufs(batch, n);  // write dsts to disk
+
+  if(recovering == 0) {
+    // each commit of a block pinned it once. the cache copies
+    // may already hold changes made by the open transaction,
+    // which has pinned them again if so.
+    for (tail = 0; tail < clh.n; tail++) {
+      struct buf *dbuf = bread(log.dev, clh.block[tail]);
       bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+      brelse(dbuf);
+    }
+  }
+}
+
+// Put the current header, with the next sequence number and
+// its checksum, in the other header block's buffer, and
+// return that buffer.
+static struct buf*
+next_head(void)
+{
+  struct buf *b;
+
+  clh.seq++;
+  clh.sum = headsum(&clh);
+  b = lbuf[clh.seq % 2];
+  memmove(b->data, &clh, sizeof(clh));
+  return b;
+}
+
+// Is header lh, read from disk, intact?
+static int
+head_ok(struct logheader *lh)
+{
+  return lh->n >= 0 && lh->n <= nlbuf - 2 && lh->sum == headsum(lh);
+}
+
+// Read the committed blocks named by clh into the log
+// buffers, all at once. Returns 0 if any does not match its
+// checksum.
+static int
+read_log(void)
+{
+  int tail;
+
+  for (tail = 0; tail < clh.n; tail++) {
+    acquiresleep(&lbuf[tail+2]->lock);
+    lbuf[tail+2]->blockno = log.start+tail+2;
+  }
+  breadv(lbuf+2, clh.n);
+  for (tail = 0; tail < clh.n; tail++)
+    releasesleep(&lbuf[tail+2]->lock);
+
+  for (tail = 0; tail < clh.n; tail++) {
+    if (cksum(CKSEED, lbuf[tail+2]->data, BSIZE) != clh.bsum[tail])
+      return 0;
   }
+  return 1;
 }
 
-// Read the log header from disk into the in-memory log header
+// Read both headers, and make the newest intact one whose
+// blocks are intact the current header. If neither is, there
+// is nothing to install.
 static void
 read_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  struct logheader *h0 = (struct logheader *) (lbuf[0]->data);
+  struct logheader *h1 = (struct logheader *) (lbuf[1]->data);
+  struct logheader *try[2];
+  int i, n = 0;
+
+  acquiresleep(&lbuf[0]->lock);
+  acquiresleep(&lbuf[1]->lock);
+  breadv(lbuf, 2);
+  releasesleep(&lbuf[1]->lock);
+  releasesleep(&lbuf[0]->lock);
+
+  if (head_ok(h0))
+    try[n++] = h0;
+  if (head_ok(h1))
+    try[n++] = h1;
+  if (n == 2 && h1->seq > h0->seq) {
+    try[0] = h1;
+    try[1] = h0;
+  }
+  memset(&clh, 0, sizeof(clh));
+  for (i = 0; i < n; i++) {
+    memmove(&clh, try[i], sizeof(clh));
+    if (read_log())
+      return;
+    printf("recovering: blocks of header %d are torn, trying the other\n",
+           clh.seq % 2);
+    clh.n = 0;
   }
-  brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Install the logged blocks, and empty the log.
 static void
-write_head(void)
+checkpoint(int recovering)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
-  }
-  bwrite(buf);
-  brelse(buf);
+  struct buf *b;
+
+  install_trans(recovering);
+  clh.n = 0;
+  b = next_head();
+  write_bufs(&b, 1);
 }
 
 static void
 recover_from_log(void)
 {
+  uint64 t0 = r_time();
+  int n;
+
   read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  n = clh.n;
+  checkpoint(1); // if committed, copy from log to disk
+  if (n > 0)
+    printf("recovering: installed %d blocks in %d us\n", n,
+           (int) ((r_time() - t0) / (TIMEFREQ/1000000)));
 }
 
 // called at the start of each FS system call.
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the end of each FS system call.
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// The most log blocks one FS system call may reserve: half
+// the log, so that a large write leaves room for others.
+int
+logmaxop(void)
+{
+  return log.size / 2;
+}
+
+// start an FS system call that writes at most n blocks.
+void
+begin_opn(int n)
+{
+  if(n > logmaxop())
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
-      sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGBLOCKS){
-      // this op might exhaust log space; wait for commit.
+    if(log.copying){
       sleep(&log, &log.lock);
+    } else if(log.lh.n + log.reserved + n > log.size){
+      // this op might exhaust log space; wait for commit,
+      // or commit now if the open transaction is finished.
+      log.want = 1;
+      if(log.outstanding == 0 && !log.committing){
+        log.committing = 1;
+        release(&log.lock);
+        commit();
+        acquire(&log.lock);
+      } else {
+        sleep(&log, &log.lock);
+      }
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// end an FS system call started with begin_opn(n).
+// commits if this was the last outstanding operation and a
+// commit is wanted, unless a commit already in progress will
+// pick it up.
 void
-end_op(void)
+end_opn(int n)
 {
   int do_commit = 0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  log.reserved -= n;
+  if(log.copying)
+    panic("log.copying");
+  if(log.outstanding == 0 && !log.committing &&
+     (log.want || COMMITTICKS == 0)){
     do_commit = 1;
     log.committing = 1;
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
+    // and decrementing log.reserved has decreased
     // the amount of reserved space.
     wakeup(&log);
   }
@@ -168,38 +408,140 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy the blocks logged from slot from on, which
+// commit() took from the open transaction, from the cache to
+// the log buffers, and checksum them.
 static void
-write_log(void)
+copy_log(int from)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (tail = from; tail < clh.n; tail++) {
+    struct buf *b = bread(log.dev, clh.block[tail]); // cache block
+    memmove(lbuf[tail+2]->data, b->data, BSIZE);
+    brelse(b);
+    clh.bsum[tail] = cksum(CKSEED, lbuf[tail+2]->data, BSIZE);
   }
 }
 
+// Write the log buffers from slot from on, and the new
+// header, to the log as one batch. This is the true point
+// at which the transaction commits.
+static void
+write_log(int from)
+{
+  int tail, n = 0;
+
+  for (tail = from; tail < clh.n; tail++) {
+    lbuf[tail+2]->blockno = log.start+tail+2;
+    batch[n++] = lbuf[tail+2];
+  }
+  batch[n++] = next_head();
+  write_bufs(batch, n);
+}
+
+// Commit transactions until the open transaction is empty
+// or still has operations in progress.
+// Caller must have set log.committing.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+  uint seq;
+  int from;
+
+  acquire(&log.lock);
+  while(log.outstanding == 0 && log.lh.n > 0){
+    if(clh.n + log.lh.n > log.size){
+      // no room after the logged transactions.
+      release(&log.lock);
+      checkpoint(0);
+      acquire(&log.lock);
+      continue;
+    }
+
+    // take over the open transaction. no FS system call is
+    // executing, so its blocks are stable until copying is cleared.
+    log.copying = 1;
+    log.want = 0;
+    from = clh.n;
+    memmove(&clh.block[from], log.lh.block, log.lh.n * sizeof(int));
+    clh.n += log.lh.n;
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    seq = log.seq++;
+    release(&log.lock);
+
+    copy_log(from);  // Copy modified blocks from cache to log buffers
+
+    acquire(&log.lock);
+    log.copying = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    write_log(from); // Write log buffers and header -- the real commit
+
+    acquire(&log.lock);
+    log.done = seq;
+    wakeup(&log);    // log_sync() may be waiting for it
+  }
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Commit the open transaction as soon as no FS system call
+// is executing in it: now, if none is and no commit is in
+// progress, or else when the last one calls end_op().
+static void
+want_commit(void)
+{
+  int do_commit = 0;
+
+  acquire(&log.lock);
+  if(log.lh.n > 0){
+    log.want = 1;
+    if(log.outstanding == 0 && !log.committing){
+      log.committing = 1;
+      do_commit = 1;
+    }
+  }
+  release(&log.lock);
+
+  if(do_commit)
+    commit();
+}
+
+// Wait until the FS system calls that have finished are on
+// disk. Must not be called inside a transaction.
+void
+log_sync(void)
+{
+  uint seq;
+
+  acquire(&log.lock);
+  // their blocks are in the open transaction, if it has any,
+  // or else in ones that have committed or are committing.
+  seq = log.lh.n > 0 ? log.seq : log.seq - 1;
+  release(&log.lock);
+
+  want_commit();
+
+  acquire(&log.lock);
+  while(log.done < seq)
+    sleep(&log, &log.lock);
+  release(&log.lock);
+}
+
+// Kernel thread that commits the open transaction
+// every COMMITTICKS ticks.
+static void
+logflusher(void)
+{
+  for(;;){
+    timersleep(r_time() + COMMITTICKS*TICKCYCLES);
+    want_commit();
   }
 }
 
@@ -218,7 +560,7 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGBLOCKS)
+  if (log.lh.n >= log.size)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -234,4 +576,3 @@ log_write(struct buf *b)
   }
   release(&log.lock);
 }
-
@@ -2,14 +2,19 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // min size of in-memory i-node table
+#define NDENTRY     256  // size of directory name cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGBLOCKS    (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define LOGBLOCKS    (MAXOPBLOCKS*12) // data blocks in on-disk log made by mkfs
+#define NBUF         (MAXOPBLOCKS*8)  // min size of disk block cache
+#define RAMAX        16  // max blocks to read ahead of a sequential reader
+#define TIMEFREQ     10000000  // time register rate in Hz (qemu virt)
+#define TICKCYCLES   (TIMEFREQ/10) // time register cycles per scheduling tick
+#define COMMITTICKS  10  // ticks between log commits; 0 to commit at each end_op
+#define FSSIZE       20000 // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
 
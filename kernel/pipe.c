@@ -8,17 +8,40 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
+#define PIPEPAGES 4
+#define PIPESIZE (PIPEPAGES*PGSIZE)
+
+// The buffer is a ring of PIPEPAGES pages. pipewrite() and
+// piperead() copy as much as they can at a time, up to the end
+// of a page, rather than a byte at a time.
+//
+// splice() fills or drains the ring from the buffer cache,
+// which may sleep, so it cannot hold pi->lock while it does.
+// Instead it marks the pipe busy, and other writers (or
+// readers) wait until it is done.
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data[PIPEPAGES];
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int wbusy;      // pipewbegin() has reserved room
+  int rbusy;      // piperbegin() has lent out data
 };
 
+static void
+pipefree(struct pipe *pi)
+{
+  for(int i = 0; i < PIPEPAGES; i++){
+    if(pi->data[i])
+      kfree(pi->data[i]);
+  }
+  kfree((char*)pi);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,6 +53,11 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(pi, 0, sizeof(*pi));
+  for(int i = 0; i < PIPEPAGES; i++){
+    if((pi->data[i] = kalloc()) == 0)
+      goto bad;
+  }
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
@@ -47,7 +75,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    pipefree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,7 +96,7 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
@@ -76,7 +104,8 @@ pipeclose(struct pipe *pi, int writable)
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, m;
+  uint off;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -85,15 +114,18 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+    if(pi->nwrite == pi->nread + PIPESIZE || pi->wbusy){ //DOC: pipewrite-full
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      // as much as there is room for, up to the end of a page.
+      off = pi->nwrite % PIPESIZE;
+      m = min(n - i, PGSIZE - off % PGSIZE);
+      m = min(m, pi->nread + PIPESIZE - pi->nwrite);
+      if(copyin(pr->pagetable, pi->data[off / PGSIZE] + off % PGSIZE, addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
   wakeup(&pi->nread);
@@ -105,30 +137,115 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, m;
+  uint off;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while((pi->nread == pi->nwrite && pi->writeopen) || pi->rbusy){  //DOC: pipe-empty
     if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
+  for(i = 0; i < n; i += m){  //DOC: piperead-copy
     if(pi->nread == pi->nwrite)
       break;
-    ch = pi->data[pi->nread % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1) {
+    // as much as there is, up to the end of a page.
+    off = pi->nread % PIPESIZE;
+    m = min(n - i, PGSIZE - off % PGSIZE);
+    m = min(m, pi->nwrite - pi->nread);
+    if(copyout(pr->pagetable, addr + i, pi->data[off / PGSIZE] + off % PGSIZE, m) == -1) {
       if(i == 0)
         i = -1;
       break;
     }
-    pi->nread++;
+    pi->nread += m;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+// For splice(): wait for room in pi, and reserve up to n
+// bytes of it, in one page, for the caller to fill without
+// holding pi->lock. Sets *m to the size of the room and
+// returns its address, or returns 0 if the reader has gone
+// or the caller was killed. Unless it returns 0, the caller
+// must call pipewend().
+char*
+pipewbegin(struct pipe *pi, int n, int *m)
+{
+  struct proc *pr = myproc();
+  uint off;
+
+  acquire(&pi->lock);
+  while(1){
+    if(pi->readopen == 0 || killed(pr)){
+      release(&pi->lock);
+      return 0;
+    }
+    if(pi->nwrite != pi->nread + PIPESIZE && !pi->wbusy)
+      break;
+    wakeup(&pi->nread);
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  off = pi->nwrite % PIPESIZE;
+  *m = min(n, PGSIZE - off % PGSIZE);
+  *m = min(*m, pi->nread + PIPESIZE - pi->nwrite);
+  pi->wbusy = 1;
+  release(&pi->lock);
+  return pi->data[off / PGSIZE] + off % PGSIZE;
+}
+
+// The caller of pipewbegin() has filled m bytes of the room.
+void
+pipewend(struct pipe *pi, int m)
+{
+  acquire(&pi->lock);
+  pi->nwrite += m;
+  pi->wbusy = 0;
+  wakeup(&pi->nread);
+  wakeup(&pi->nwrite);
+  release(&pi->lock);
+}
+
+// For splice(): wait for data in pi, and lend the caller up to
+// n bytes of it, in one page, to use without holding pi->lock.
+// Sets *m to how many (0 once the writer has gone) and returns
+// their address, or returns 0 if the caller was killed. Unless
+// it returns 0, the caller must call piperend().
+char*
+piperbegin(struct pipe *pi, int n, int *m)
+{
+  struct proc *pr = myproc();
+  uint off;
+
+  acquire(&pi->lock);
+  while((pi->nread == pi->nwrite && pi->writeopen) || pi->rbusy){
+    if(killed(pr)){
+      release(&pi->lock);
+      return 0;
+    }
+    sleep(&pi->nread, &pi->lock);
+  }
+  off = pi->nread % PIPESIZE;
+  *m = min(n, PGSIZE - off % PGSIZE);
+  *m = min(*m, pi->nwrite - pi->nread);
+  pi->rbusy = 1;
+  release(&pi->lock);
+  return pi->data[off / PGSIZE] + off % PGSIZE;
+}
+
+// The caller of piperbegin() has used m bytes of the data.
+void
+piperend(struct pipe *pi, int m)
+{
+  acquire(&pi->lock);
+  pi->nread += m;
+  pi->rbusy = 0;
+  wakeup(&pi->nwrite);
+  wakeup(&pi->nread);
+  release(&pi->lock);
+}
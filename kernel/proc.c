@@ -17,9 +17,110 @@ struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void setrunnable(struct proc *p);
+static void kickidle(int id);
+static void addchild(struct proc *p, struct proc *c);
 
 extern char trampoline[]; // trampoline.S
 
+// Per-CPU queues of RUNNABLE processes, in order of virtual
+// runtime, linked through p->rqnext. A RUNNABLE process is on
+// exactly one queue, CPU p->cpu's, until a scheduler takes it
+// off to run it. A CPU whose queue is empty takes work from
+// the others'. Acquire p->lock before a queue's lock.
+//
+// Fair share: each tick a process runs adds to its virtual
+// runtime in inverse proportion to its weight, which its nice
+// value sets, and the scheduler runs the process with the least.
+// A process that was asleep, like an interactive one, comes
+// back with at most VRBONUS less than the queue's least, so it
+// runs soon, but cannot save up CPU time while it sleeps.
+struct runq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+  int n;
+  uint64 minvr;  // virtual runtime of the last process taken off
+} runq[NCPU];
+
+#define VRUNIT 1024            // virtual runtime of a tick at nice 0
+#define VRBONUS (2*VRUNIT)
+
+// Weight for each nice value from -20 to 19; each step is
+// about 1.25 times the CPU of the next.
+static const int niceweight[40] = {
+  88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+  9548, 7620, 6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+  1024, 820, 655, 526, 423, 335, 272, 215, 172, 137,
+  110, 87, 70, 56, 45, 36, 29, 23, 18, 15,
+};
+
+// Processes in sleep(), hashed by channel, so that wakeup()
+// need look only at those that might be sleeping on its
+// channel. A process is on chan's queue from when it goes to
+// sleep until wakeup() or, if kkill() woke it, sleep() takes
+// it off. Acquire a wait queue's lock before p->lock.
+#define NWAITQ 61
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitq[NWAITQ];
+
+static struct waitq*
+wqhash(void *chan)
+{
+  return &waitq[(uint64)chan % NWAITQ];
+}
+
+// Take p off its wait queue, whose lock must be held.
+static void
+wqremove(struct proc *p)
+{
+  *p->wqpprev = p->wqnext;
+  if(p->wqnext)
+    p->wqnext->wqpprev = p->wqpprev;
+  p->wqnext = 0;
+  p->wqpprev = 0;
+}
+
+// Processes with pids, hashed by pid and linked through
+// p->hnext, so that kkill() and the like need not scan proc[].
+// UNUSED processes are on freeprocs instead, for allocproc().
+// pid_lock protects both; acquire p->lock before it.
+#define NPIDHASH NPROC
+
+struct proc *pidhash[NPIDHASH];
+struct proc *freeprocs;
+
+static struct proc**
+pidbucket(int pid)
+{
+  return &pidhash[(uint)pid % NPIDHASH];
+}
+
+// Return the process with the given pid, locked, or 0.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  acquire(&pid_lock);
+  for(p = *pidbucket(pid); p && p->pid != pid; p = p->hnext)
+    ;
+  release(&pid_lock);
+  if(p == 0)
+    return 0;
+  // p may have been freed since; pids are never reused,
+  // so check it's still the same process.
+  acquire(&p->lock);
+  if(p->pid != pid || p->state == UNUSED){
+    release(&p->lock);
+    return 0;
+  }
+  return p;
+}
+
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
 // memory model when using p->parent.
@@ -51,10 +152,18 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
+  for(int i = 0; i < NCPU; i++){
+    initlock(&runq[i].lock, "runq");
+    runq[i].minvr = VRBONUS;  // so no virtual runtime goes below 0
+  }
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
+  for(p = &proc[NPROC-1]; p >= proc; p--) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
       p->kstack = KSTACK((int) (p - proc));
+      p->hnext = freeprocs;
+      freeprocs = p;
   }
 }
 
@@ -89,20 +198,23 @@ myproc(void)
   return p;
 }
 
-int
-allocpid()
+// Give p, whose lock must be held, a pid,
+// and enter it in pidhash.
+void
+allocpid(struct proc *p)
 {
-  int pid;
-  
+  struct proc **h;
+
   acquire(&pid_lock);
-  pid = nextpid;
+  p->pid = nextpid;
   nextpid = nextpid + 1;
+  h = pidbucket(p->pid);
+  p->hnext = *h;
+  *h = p;
   release(&pid_lock);
-
-  return pid;
 }
 
-// Look in the process table for an UNUSED proc.
+// Take an UNUSED proc off freeprocs.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
 // If there are no free procs, or a memory allocation fails, return 0.
@@ -111,19 +223,20 @@ allocproc(void)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
-  }
-  return 0;
+  acquire(&pid_lock);
+  if((p = freeprocs) != 0)
+    freeprocs = p->hnext;
+  release(&pid_lock);
+  if(p == 0)
+    return 0;
 
-found:
-  p->pid = allocpid();
+  acquire(&p->lock);
+  allocpid(p);
   p->state = USED;
+  p->cpu = cpuid();
+  p->nice = 0;
+  p->vruntime = 0;
+  p->ticks = 0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -155,6 +268,8 @@ found:
 static void
 freeproc(struct proc *p)
 {
+  struct proc **pp;
+
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
@@ -162,12 +277,20 @@ freeproc(struct proc *p)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  acquire(&pid_lock);
+  for(pp = pidbucket(p->pid); *pp != p; pp = &(*pp)->hnext)
+    ;
+  *pp = p->hnext;
+  p->hnext = freeprocs;
+  freeprocs = p;
+  release(&pid_lock);
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->kfn = 0;
   p->state = UNUSED;
 }
 
@@ -226,11 +349,42 @@ userinit(void)
   
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kprocstart.
+static void
+kprocstart(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn();
+  panic("kproc returned");
+}
+
+// Start a kernel thread, which runs fn in the kernel and
+// never returns to user space. fn must not return. It is
+// nobody's child, so no one waits for it.
+void
+kproc(void (*fn)(void), char *name)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kproc");
+  p->kfn = fn;
+  p->context.ra = (uint64)kprocstart;
+  safestrcpy(p->name, name, sizeof(p->name));
+  setrunnable(p);
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -290,21 +444,37 @@ kfork(void)
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
+  np->nice = p->nice;
+  np->vruntime = p->vruntime;
+
   pid = np->pid;
 
   release(&np->lock);
 
   acquire(&wait_lock);
   np->parent = p;
+  addchild(p, np);
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
 }
 
+// Add c to the front of p's list of children.
+// Caller must hold wait_lock.
+static void
+addchild(struct proc *p, struct proc *c)
+{
+  c->sibling = p->children;
+  if(c->sibling)
+    c->sibling->sibpprev = &c->sibling;
+  c->sibpprev = &p->children;
+  p->children = c;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -312,12 +482,14 @@ reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  if(p->children == 0)
+    return;
+  while((pp = p->children) != 0){
+    p->children = pp->sibling;
+    pp->parent = initproc;
+    addchild(initproc, pp);
   }
+  wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -377,30 +549,31 @@ kwait(uint64 addr)
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through p's children looking for exited ones.
     havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
-
-        havekids = 1;
-        if(pp->state == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
+    for(pp = p->children; pp; pp = pp->sibling){
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
+
+      havekids = 1;
+      if(pp->state == ZOMBIE){
+        // Found one.
+        pid = pp->pid;
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                                sizeof(pp->xstate)) < 0) {
           release(&pp->lock);
           release(&wait_lock);
-          return pid;
+          return -1;
         }
+        *pp->sibpprev = pp->sibling;
+        if(pp->sibling)
+          pp->sibling->sibpprev = pp->sibpprev;
+        freeproc(pp);
         release(&pp->lock);
+        release(&wait_lock);
+        return pid;
       }
+      release(&pp->lock);
     }
 
     // No point waiting if we don't have any children.
@@ -414,10 +587,86 @@ kwait(uint64 addr)
   }
 }
 
+// Make p RUNNABLE, and put it on its CPU's run queue, after
+// the processes with no more virtual runtime.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  struct runq *rq = &runq[p->cpu];
+  struct proc **pp;
+
+  p->state = RUNNABLE;
+  acquire(&rq->lock);
+  if(p->vruntime + VRBONUS < rq->minvr)
+    p->vruntime = rq->minvr - VRBONUS;
+  for(pp = &rq->head; *pp && (*pp)->vruntime <= p->vruntime; pp = &(*pp)->rqnext)
+    ;
+  p->rqnext = *pp;
+  *pp = p;
+  if(p->rqnext == 0)
+    rq->tail = p;
+  rq->n++;
+  release(&rq->lock);
+  kickidle(p->cpu);
+}
+
+// an idle hart takes no timer interrupts, so wake one to
+// run a newly runnable process, preferring the hart whose
+// queue it is on. the scheduler sets c->idle before its last
+// look at the run queues, so it can't miss this.
+static void
+kickidle(int id)
+{
+  __sync_synchronize();
+  if(!cpus[id].idle){
+    for(id = 0; id < NCPU; id++)
+      if(cpus[id].idle)
+        break;
+    if(id == NCPU)
+      return;
+  }
+  if(id != cpuid())
+    ipi(id);
+}
+
+// Take the process at the head of CPU id's run queue, or if
+// that is empty, of the next CPU's that is not. Returns 0 if
+// all are empty.
+static struct proc*
+runqget(int id)
+{
+  struct runq *rq;
+  struct proc *p;
+
+  for(int i = 0; i < NCPU; i++){
+    rq = &runq[(id + i) % NCPU];
+    if(rq->n == 0)
+      continue;  // a hint; checked again below
+    acquire(&rq->lock);
+    p = rq->head;
+    if(p){
+      rq->head = p->rqnext;
+      if(rq->head == 0)
+        rq->tail = 0;
+      rq->n--;
+      if(p->vruntime > rq->minvr)
+        rq->minvr = p->vruntime;
+      // measure p's virtual runtime against its new queue's.
+      p->vruntime += runq[id].minvr - rq->minvr;
+    }
+    release(&rq->lock);
+    if(p)
+      return p;
+  }
+  return 0;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run: the one at the head of this
+//    CPU's run queue, or if it has none, another CPU's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -437,28 +686,39 @@ scheduler(void)
     intr_on();
     intr_off();
 
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-        found = 1;
+    if((p = runqget(cpuid())) == 0) {
+      // nothing to run; stop running on this core until a
+      // deadline on the timer queue or an ipi from kickidle().
+      c->idle = 1;
+      __sync_synchronize();
+      if((p = runqget(cpuid())) == 0){
+        timerreset();
+        asm volatile("wfi");
+        continue;
       }
-      release(&p->lock);
     }
-    if(found == 0) {
-      // nothing to run; stop running on this core until an interrupt.
-      asm volatile("wfi");
+    if(c->idle){
+      // back to work; resume preemption ticks.
+      c->idle = 0;
+      c->tick = r_time() + TICKCYCLES;
+      timerreset();
     }
+
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler");
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = cpuid();
+    c->proc = p;
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -490,12 +750,15 @@ sched(void)
 }
 
 // Give up the CPU for one scheduling round.
+// Called at each timer interrupt, so also charges p a tick.
 void
 yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  p->ticks++;
+  p->vruntime += VRUNIT * 1024 / niceweight[p->nice + 20];
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -543,28 +806,42 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = wqhash(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold chan's wait queue lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks it),
   // so it's okay to release lk.
 
+  acquire(&wq->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->wqnext = wq->head;
+  if(wq->head)
+    wq->head->wqpprev = &p->wqnext;
+  wq->head = p;
+  p->wqpprev = &wq->head;
+  release(&wq->lock);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // wakeup() took p off the wait queue, unless kkill() woke it.
+  acquire(&wq->lock);
+  if(p->wqpprev)
+    wqremove(p);
+  release(&wq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -573,41 +850,62 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct waitq *wq = wqhash(chan);
+  struct proc *p, *next;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  acquire(&wq->lock);
+  for(p = wq->head; p; p = next) {
+    next = p->wqnext;
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        wqremove(p);
+        setrunnable(p);
       }
       release(&p->lock);
     }
   }
+  release(&wq->lock);
+}
+
+// Set the nice value of the process with the given pid,
+// from -20 (most CPU) to 19 (least).
+int
+ksetpriority(int pid, int nice)
+{
+  struct proc *p;
+
+  if(nice < -20 || nice > 19)
+    return -1;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->nice = nice;
+  release(&p->lock);
+  return 0;
 }
 
 // Kill the process with the given pid.
 // The victim won't exit until it tries to return
 // to user space (see usertrap() in trap.c).
+// Kernel threads never return to user space, so can't be killed.
 int
 kkill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
+  if((p = findproc(pid)) == 0)
+    return -1;
+  if(p->kfn){
     release(&p->lock);
+    return -1;
   }
-  return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    setrunnable(p);
+  }
+  release(&p->lock);
+  return 0;
 }
 
 void
@@ -684,7 +982,7 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
+    printf("%d %s %s nice %d ticks %d", p->pid, state, p->name, p->nice, p->ticks);
     printf("\n");
   }
 }
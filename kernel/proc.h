@@ -24,6 +24,8 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int idle;                   // In scheduler's wfi, no ticks until a deadline or ipi.
+  uint64 tick;                // Time of the next preemption tick.
 };
 
 extern struct cpu cpus[NCPU];
@@ -91,9 +93,30 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // Run queue to put p on when RUNNABLE
+  int nice;                    // -20 (most CPU) to 19 (least)
+  uint64 vruntime;             // Ticks run, weighted by nice
+  uint ticks;                  // Ticks run
 
-  // wait_lock must be held when using this:
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *children;       // First child
+  struct proc *sibling;        // Next child of parent
+  struct proc **sibpprev;      // What points to p on parent's list
+
+  // pid_lock must be held when using this:
+  struct proc *hnext;          // Next in pid hash bucket, or on freeprocs
+
+  // the run queue's lock must be held when using this:
+  struct proc *rqnext;         // Next process on the run queue
+
+  // the wait queue's lock must be held when using these:
+  struct proc *wqnext;         // Next process on the wait queue
+  struct proc **wqpprev;       // What points to p on it, or 0 if on none
+
+  // timerlock must be held when using these:
+  uint64 wakeat;               // Deadline while on the timer queue
+  struct proc *tnext;          // Next process on the timer queue
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
@@ -104,4 +127,5 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // Kernel thread's function, if one
 };
@@ -6,10 +6,14 @@
 
 void main();
 void timerinit();
+void ipivec();
 
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
+// ipivec's save area and CLINT MSIP address, per hart.
+uint64 ipiscratch[NCPU][3];
+
 // entry.S jumps here in machine mode on stack0.
 void
 start()
@@ -30,7 +34,7 @@ start()
   // delegate all interrupts and exceptions to supervisor mode.
   w_medeleg(0xffff);
   w_mideleg(0xffff);
-  w_sie(r_sie() | SIE_SEIE | SIE_STIE);
+  w_sie(r_sie() | SIE_SEIE | SIE_STIE | SIE_SSIE);
 
   // configure Physical Memory Protection to give supervisor mode
   // access to all of physical memory.
@@ -44,6 +48,12 @@ start()
   int id = r_mhartid();
   w_tp(id);
 
+  // take ipis from other harts in ipivec.
+  ipiscratch[id][2] = CLINT_MSIP(id);
+  w_mscratch((uint64)ipiscratch[id]);
+  w_mtvec((uint64)ipivec);
+  w_mie(r_mie() | MIE_MSIE);
+
   // switch to supervisor mode and jump to main().
   asm volatile("mret");
 }
@@ -62,5 +72,5 @@ timerinit()
   w_mcounteren(r_mcounteren() | 2);
   
   // ask for the very first timer interrupt.
-  w_stimecmp(r_time() + 1000000);
+  w_stimecmp(r_time() + TICKCYCLES);
 }
@@ -20,3 +20,7 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_fsync  22
+#define SYS_splice 23
+#define SYS_setpriority 24
+#define SYS_nanosleep 25
@@ -107,6 +107,35 @@ sys_close(void)
   return 0;
 }
 
+// Wait until what has been written to fd is on disk.
+// All files share one log, so this commits everything
+// written so far.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  log_sync();
+  return 0;
+}
+
+// Move up to n bytes from file descriptor fdin to fdout,
+// one a file and the other a pipe, without copying them
+// through user memory.
+uint64
+sys_splice(void)
+{
+  struct file *f, *g;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0 || argfd(1, 0, &g) < 0 || n < 0)
+    return -1;
+  return filesplice(f, g, n);
+}
+
 uint64
 sys_fstat(void)
 {
@@ -170,16 +199,18 @@ bad:
 }
 
 // Is the directory dp empty except for "." and ".." ?
+// They needn't be the first two entries, as in a hashed
+// directory.
 static int
 isdirempty(struct inode *dp)
 {
   int off;
   struct dirent de;
 
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
+  for(off=0; off<dp->size; off+=sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("isdirempty: readi");
-    if(de.inum != 0)
+    if(de.inum != 0 && namecmp(de.name, ".") != 0 && namecmp(de.name, "..") != 0)
       return 0;
   }
   return 1;
@@ -222,6 +253,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcacheset(dp, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -229,6 +261,8 @@ sys_unlink(void)
   iunlockput(dp);
 
   ip->nlink--;
+  if(ip->nlink == 0)
+    iorphan(ip);  // in case it is still open
   iupdate(ip);
   iunlockput(ip);
 
@@ -275,7 +309,8 @@ create(char *path, short type, short major, short minor)
 
   if(type == T_DIR){  // Create . and .. entries.
     // No ip->nlink++ for ".": avoid cyclic ref count.
-    if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
+    if(hdirinit(ip) < 0 || dirlink(ip, ".", ip->inum) < 0 ||
+       dirlink(ip, "..", dp->inum) < 0)
       goto fail;
   }
 
@@ -355,6 +390,8 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    f->ranext = 0;
+    f->rawin = 0;
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
@@ -68,22 +68,27 @@ uint64
 sys_pause(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
   if(n < 0)
     n = 0;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return timersleep(r_time() + (uint64)n*TICKCYCLES);
+}
+
+// sleep for ns nanoseconds, to the resolution of
+// the time register.
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns, cycles, now;
+
+  argaddr(0, &ns);
+  // round up to whole cycles, and saturate rather than wrap.
+  cycles = ns / (1000000000/TIMEFREQ) + (ns % (1000000000/TIMEFREQ) != 0);
+  now = r_time();
+  if(cycles > (uint64)-1 - now)
+    return timersleep((uint64)-1);
+  return timersleep(now + cycles);
 }
 
 uint64
@@ -95,15 +100,20 @@ sys_kill(void)
   return kkill(pid);
 }
 
-// return how many clock tick interrupts have occurred
-// since start.
+// set the nice value, -20 to 19, of process pid.
 uint64
-sys_uptime(void)
+sys_setpriority(void)
 {
-  uint xticks;
+  int pid, nice;
+
+  argint(0, &pid);
+  argint(1, &nice);
+  return ksetpriority(pid, nice);
+}
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+// return how many clock ticks have passed since start.
+uint64
+sys_uptime(void)
+{
+  return r_time() / TICKCYCLES;
 }
@@ -6,8 +6,13 @@
 #include "proc.h"
 #include "defs.h"
 
-struct spinlock tickslock;
-uint ticks;
+// the timer queue: sleeping processes with deadlines,
+// soonest first. each hart programs stimecmp for the
+// earlier of the queue's head and its own next preemption
+// tick, or just the head if the hart is idle, so an idle
+// hart takes no interrupts until something is due.
+struct spinlock timerlock;
+struct proc *timerq;
 
 extern char trampoline[], uservec[];
 
@@ -19,7 +24,7 @@ extern int devintr();
 void
 trapinit(void)
 {
-  initlock(&tickslock, "time");
+  initlock(&timerlock, "time");
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -70,7 +75,7 @@ usertrap(void)
     // ok
   } else if((r_scause() == 15 || r_scause() == 13) &&
             vmfault(p->pagetable, r_stval(), (r_scause() == 13)? 1 : 0) != 0) {
-    // page fault on lazily-allocated page
+    // page fault on lazily-allocated or copy-on-write page
   } else {
     printf("usertrap(): unexpected scause 0x%lx pid=%d\n", r_scause(), p->pid);
     printf("            sepc=0x%lx stval=0x%lx\n", r_sepc(), r_stval());
@@ -161,25 +166,101 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// program this hart's next timer interrupt.
+// caller must hold timerlock.
+static void
+settimer(void)
+{
+  struct cpu *c = mycpu();
+  uint64 when;
+
+  when = c->idle ? (uint64)-1 : c->tick;
+  if(timerq && timerq->wakeat < when)
+    when = timerq->wakeat;
+  // this also clears any pending timer interrupt.
+  w_stimecmp(when);
+}
+
+// called by the scheduler when the hart goes idle or
+// comes back from idle.
 void
+timerreset(void)
+{
+  acquire(&timerlock);
+  settimer();
+  release(&timerlock);
+}
+
+// sleep until the time register reaches when.
+// returns -1 if killed first.
+int
+timersleep(uint64 when)
+{
+  struct proc *p = myproc();
+  struct proc **pp;
+
+  acquire(&timerlock);
+  while(r_time() < when){
+    if(killed(p)){
+      release(&timerlock);
+      return -1;
+    }
+    for(pp = &timerq; *pp && (*pp)->wakeat <= when; pp = &(*pp)->tnext)
+      ;
+    p->wakeat = when;
+    p->tnext = *pp;
+    *pp = p;
+    if(timerq == p)
+      settimer();
+    sleep(&p->wakeat, &timerlock);
+    // kill() can wake p before clockintr() takes it off.
+    for(pp = &timerq; *pp; pp = &(*pp)->tnext){
+      if(*pp == p){
+        *pp = p->tnext;
+        break;
+      }
+    }
+  }
+  release(&timerlock);
+  return 0;
+}
+
+// wake processes whose deadlines have passed.
+// returns 1 if it's time for this hart's preemption tick.
+int
 clockintr()
 {
-  if(cpuid() == 0){
-    acquire(&tickslock);
-    ticks++;
-    wakeup(&ticks);
-    release(&tickslock);
+  struct cpu *c = mycpu();
+  struct proc *p;
+  uint64 now;
+  int tick = 0;
+
+  acquire(&timerlock);
+  now = r_time();
+  while((p = timerq) != 0 && p->wakeat <= now){
+    timerq = p->tnext;
+    wakeup(&p->wakeat);
   }
+  if(!c->idle && c->tick <= now){
+    c->tick = now + TICKCYCLES;
+    tick = 1;
+  }
+  settimer();
+  release(&timerlock);
+  return tick;
+}
 
-  // ask for the next timer interrupt. this also clears
-  // the interrupt request. 1000000 is about a tenth
-  // of a second.
-  w_stimecmp(r_time() + 1000000);
+// interrupt another hart, to get an idle one to look
+// at the run queues.
+void
+ipi(int hart)
+{
+  *(volatile uint32 *)CLINT_MSIP(hart) = 1;
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
+// returns 2 if preemption tick,
 // 1 if other device,
 // 0 if not recognized.
 int
@@ -210,8 +291,11 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000005L){
     // timer interrupt.
-    clockintr();
-    return 2;
+    return clockintr() ? 2 : 1;
+  } else if(scause == 0x8000000000000001L){
+    // software interrupt, an ipi passed on by ipivec.
+    w_sip(r_sip() & ~2);
+    return 1;
   } else {
     return 0;
   }
@@ -212,27 +212,19 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// format the three descriptors idx[] for a request to read or
+// write b, and add the request to the avail ring.
+// does not tell the device; the caller must do that.
+// caller holds vdisk_lock.
+static void
+virtio_disk_queue(struct buf *b, int write, int *idx)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
 
-  acquire(&disk.vdisk_lock);
-
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
   // data, one for a 1-byte status result.
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
-
-  // format the three descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -277,20 +269,53 @@ virtio_disk_rw(struct buf *b, int write)
   disk.avail->idx += 1; // not % NUM ...
 
   __sync_synchronize();
+}
+
+// start reading or writing each of the n bufs in bs, without
+// waiting for the disk to finish. as many requests as fit in the
+// descriptor ring are queued before the device is told about them,
+// so that it can work on several at once. virtio_disk_intr()
+// clears b->disk and wakes up b when the disk is done with b.
+void
+virtio_disk_submit(struct buf **bs, int n, int write)
+{
+  int idx[3];
+
+  acquire(&disk.vdisk_lock);
+
+  for(int i = 0; i < n; i++){
+    while(alloc3_desc(idx) != 0){
+      // the ring is full; let the device start on the
+      // requests queued so far, and wait for one to finish.
+      *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0;
+      sleep(&disk.free[0], &disk.vdisk_lock);
+    }
+    virtio_disk_queue(bs[i], write, idx);
+  }
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  release(&disk.vdisk_lock);
+}
+
+// wait for virtio_disk_intr() to say the request for b has finished.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
-
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_submit(&b, 1, write);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
@@ -317,8 +342,13 @@ virtio_disk_intr()
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
+    disk.info[id].b = 0;
+    free_chain(id);
     b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    if(b->async)
+      bdone(b);    // no one waits for a read-ahead
+    else
+      wakeup(b);
 
     disk.used_idx += 1;
   }
@@ -32,6 +32,9 @@ kvmmake(void)
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+  // CLINT, for ipi()
+  kvmmap(kpgtbl, CLINT, CLINT, PGSIZE, PTE_R | PTE_W);
+
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W);
 
@@ -289,8 +292,9 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies the page table but not the physical
+// memory: writable pages are shared copy-on-write,
+// read-only pages are simply shared.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
@@ -299,22 +303,22 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
       continue;   // page table entry hasn't been allocated
     if((*pte & PTE_V) == 0)
       continue;   // physical page hasn't been allocated
+    if(*pte & PTE_W){
+      // the first store by either process will fault,
+      // and vmfault() will give it a private copy.
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    }
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
-    }
+    kref((void*)pa);
   }
   return 0;
 
@@ -358,9 +362,14 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
     }
 
     pte = walk(pagetable, va0, 0);
-    // forbid copyout over read-only user text pages.
-    if((*pte & PTE_W) == 0)
-      return -1;
+    if((*pte & PTE_W) == 0){
+      // forbid copyout over read-only user text pages,
+      // but break copy-on-write sharing.
+      if((*pte & PTE_COW) == 0)
+        return -1;
+      if((pa0 = vmfault(pagetable, va0, 0)) == 0)
+        return -1;
+    }
       
     n = PGSIZE - (dstva - va0);
     if(n > len)
@@ -445,10 +454,41 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   }
 }
 
+// Give the process its own writable copy of the copy-on-write
+// page at va, or just make the page writable if no other
+// process still shares it.
+// returns 0 if va is not a copy-on-write page, or if out of
+// physical memory, and physical address if successful.
+static uint64
+cowfault(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  char *mem;
+
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 ||
+     (*pte & PTE_COW) == 0)
+    return 0;
+  pa = PTE2PA(*pte);
+  if(krefcnt((void*)pa) == 1){
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+    return pa;
+  }
+  if((mem = kalloc()) == 0)
+    return 0;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  kfree((void*)pa);
+  return (uint64)mem;
+}
+
 // allocate and map user memory if process is referencing a page
-// that was lazily allocated in sys_sbrk().
-// returns 0 if va is invalid or already mapped, or if
-// out of physical memory, and physical address if successful.
+// that was lazily allocated in sys_sbrk(), or copy a page that
+// fork() shared copy-on-write if the process is writing it.
+// returns 0 if va is invalid or already mapped (and not
+// copy-on-write), or if out of physical memory, and physical
+// address if successful.
 uint64
 vmfault(pagetable_t pagetable, uint64 va, int read)
 {
@@ -459,7 +499,9 @@ vmfault(pagetable_t pagetable, uint64 va, int read)
     return 0;
   va = PGROUNDDOWN(va);
   if(ismapped(pagetable, va)) {
-    return 0;
+    if(read)
+      return 0;
+    return cowfault(pagetable, va);
   }
   mem = (uint64) kalloc();
   if(mem == 0)
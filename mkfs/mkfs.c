@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/BPB + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGBLOCKS+1;   // Header followed by LOGBLOCKS data blocks.
+int nlog = LOGBLOCKS+2;   // Two headers followed by LOGBLOCKS data blocks.
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -40,6 +40,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirappend(uint dinum, char *name, uint inum);
 void die(const char *);
 
 // convert to riscv byte order
@@ -69,8 +70,7 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  uint rootino, inum;
   char buf[BSIZE];
   struct dinode din;
 
@@ -84,6 +84,9 @@ main(int argc, char *argv[])
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
+  assert(sizeof(struct dirptr) == sizeof(struct dirent));
+  assert(LOGBLOCKS <= MAXLOGBLOCKS);
+  assert(NINODES <= 65536);  // dinode.orphan is a ushort
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0)
@@ -114,18 +117,17 @@ main(int argc, char *argv[])
   memmove(buf, &sb, sizeof(sb));
   wsect(1, buf);
 
+  // the root directory is hashed; start it with
+  // an empty bucket table.
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
+  rinode(rootino, &din);
+  din.flags = xshort(D_HASHED);
+  winode(rootino, &din);
+  iappend(rootino, zeroes, BSIZE);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  dirappend(rootino, ".", rootino);
+  dirappend(rootino, "..", rootino);
 
   for(i = 2; i < argc; i++){
     // get rid of "user/"
@@ -150,11 +152,7 @@ main(int argc, char *argv[])
     assert(strlen(shortname) <= DIRSIZ);
     
     inum = ialloc(T_FILE);
-
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    dirappend(rootino, shortname, inum);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -162,13 +160,6 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
-
   balloc(freeblock);
 
   exit(0);
@@ -251,6 +242,53 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the disk block holding block fbn of the file,
+// giving the file the next free block if fbn is just past
+// its end. Files made by mkfs don't need the doubly-indirect
+// block.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  struct extent ext[NIEXTENT];
+  struct extent *e, *prev;
+  uint base, x;
+  int i;
+
+  memset(ext, 0, sizeof(ext));
+  if(xint(din->extblk) != 0)
+    rsect(xint(din->extblk), (char*)ext);
+
+  base = 0;
+  prev = 0;
+  for(i = 0; i < NDEXTENT + NIEXTENT; i++){
+    e = i < NDEXTENT ? &din->ext[i] : &ext[i - NDEXTENT];
+    if(xint(e->len) == 0)
+      break;
+    if(fbn - base < xint(e->len))
+      return xint(e->start) + fbn - base;
+    base += xint(e->len);
+    prev = e;
+  }
+  assert(fbn == base);
+
+  x = freeblock++;
+  if(prev && xint(prev->start) + xint(prev->len) == x){
+    e = prev;
+    e->len = xint(xint(e->len) + 1);
+  } else {
+    assert(i < NDEXTENT + NIEXTENT);
+    if(i >= NDEXTENT && xint(din->extblk) == 0){
+      din->extblk = xint(x);
+      x = freeblock++;
+    }
+    e->start = xint(x);
+    e->len = xint(1);
+  }
+  if(e >= ext && e < ext + NIEXTENT)
+    wsect(xint(din->extblk), (char*)ext);
+  return x;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -258,7 +296,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -267,22 +304,7 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = bmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -295,6 +317,62 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// Same as dirhash() in kernel/fs.c.
+uint
+dirhash(char *name)
+{
+  uint h = 2166136261;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h % NHBUCKET;
+}
+
+// Add an entry for name to the hashed directory dinum, in the
+// first free slot of bucket dirhash(name), giving the bucket
+// a new block if it has none (see kernel/fs.c).
+void
+dirappend(uint dinum, char *name, uint inum)
+{
+  struct dinode din;
+  struct dirent de[DPB];
+  struct dirptr *p = (struct dirptr*)de;
+  uint h, bn, next, *link, x, j;
+
+  rinode(dinum, &din);
+  assert(xshort(din.flags) & D_HASHED);
+  h = dirhash(name);
+  for(bn = 0; ; bn = next){
+    x = bmap(&din, bn);
+    rsect(x, (char*)de);
+    for(j = 0; bn != 0 && j < DPB-1; j++){
+      if(de[j].inum == 0){
+        de[j].inum = xshort(inum);
+        strncpy(de[j].name, name, DIRSIZ);
+        wsect(x, (char*)de);
+        return;
+      }
+    }
+    link = bn == 0 ? &p[h/3].bn[h%3] : &p[DPB-1].bn[0];
+    if((next = xint(*link)) == 0)
+      break;
+  }
+
+  // no free slot: link a new block after bn.
+  next = xint(din.size) / BSIZE;
+  *link = xint(next);
+  wsect(x, (char*)de);
+  iappend(dinum, zeroes, BSIZE);
+  rinode(dinum, &din);
+  x = bmap(&din, next);
+  rsect(x, (char*)de);
+  de[0].inum = xshort(inum);
+  strncpy(de[0].name, name, DIRSIZ);
+  wsect(x, (char*)de);
+}
+
 void
 die(const char *s)
 {
@@ -6,7 +6,8 @@
 # ./test-xv6.py usertests  (runs usertests)
 # ./test-xv6.py -q usertests (runs the quick tests of usertests)
 # ./test-xv6.py crash  (runs the crash tests)
-# ./test-xv6.py log (runs the log crash test)
+# ./test-xv6.py log (runs the log crash test, reports how long recovery took)
+# ./test-xv6.py commitbench (reports logstress write throughput)
 
 import argparse, os, inspect, re, signal, subprocess, sys, time
 from subprocess import run
@@ -123,7 +124,8 @@ def recover_log():
     q = QEMU()
     time.sleep(2)
     q.read()
-    ok, _ = q.match('^recovering', exit=False)
+    # the kernel reports how long installing the log took.
+    ok, _ = q.match('^recovering: installed', exit=False)
     if ok:
         q.cmd("ls\n")
         time.sleep(2)
@@ -186,6 +188,14 @@ def test_crash():
     test_forphan()
     test_dorphan()
 
+def test_commitbench():
+    print("Measure logstress write throughput")
+    q = QEMU(True)
+    q.cmd("logstress f0 f1 f2 f3 f4 f5\n")
+    q.monitor('^logstress: ', timeout=300)
+    q.stop()
+    print("OK")
+
 def test_usertests(test=""):
     timeout = 600
     opt = ""
@@ -0,0 +1,25 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// nice n cmd args: run cmd with nice value n, from -20
+// (most CPU) to 19 (least), e.g. nice 10 grind.
+
+int
+main(int argc, char *argv[])
+{
+  int n;
+
+  if(argc < 3){
+    fprintf(2, "usage: nice n cmd args...\n");
+    exit(1);
+  }
+  n = argv[1][0] == '-' ? -atoi(argv[1] + 1) : atoi(argv[1]);
+  if(setpriority(getpid(), n) < 0){
+    fprintf(2, "nice: bad nice value %s\n", argv[1]);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "nice: exec %s failed\n", argv[2]);
+  exit(1);
+}
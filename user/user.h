@@ -24,6 +24,10 @@ int getpid(void);
 char* sys_sbrk(int,int);
 int pause(int);
 int uptime(void);
+int fsync(int);
+int splice(int, int, int);
+int setpriority(int, int);
+int nanosleep(uint64);
 
 // ulib.c
 int stat(const char*, struct stat*);
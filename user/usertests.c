@@ -578,9 +578,12 @@ writetest(char *s)
   }
 }
 
+// a file larger than 12 direct blocks plus one
+// indirect block could hold.
 void
 writebig(char *s)
 {
+  enum { NBIG = 400 };
   int i, fd, n;
 
   fd = open("big", O_CREATE|O_RDWR);
@@ -589,7 +592,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed i=%d\n", s, i);
@@ -609,7 +612,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n != MAXFILE){
+      if(n != NBIG){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -997,6 +1000,199 @@ forkfork(char *s)
   }
 }
 
+// more processes than CPUs, in pairs that pass a byte back
+// and forth through pipes, so that each wakes the other and
+// the run queues fill and empty; all must get to run.
+void
+pingpong(char *s)
+{
+  enum { NPAIR = NCPU, N = 200 };
+  int pids[2*NPAIR], xstatus;
+  char c = 0;
+
+  for(int i = 0; i < NPAIR; i++){
+    int ab[2], ba[2];
+    if(pipe(ab) < 0 || pipe(ba) < 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    for(int j = 0; j < 2; j++){
+      pids[2*i+j] = fork();
+      if(pids[2*i+j] < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pids[2*i+j] == 0){
+        int in = j == 0 ? ba[0] : ab[0];
+        int out = j == 0 ? ab[1] : ba[1];
+        for(int k = 0; k < N; k++){
+          if(j == 0 && write(out, &c, 1) != 1)
+            exit(1);
+          if(read(in, &c, 1) != 1)
+            exit(1);
+          if(j == 1 && write(out, &c, 1) != 1)
+            exit(1);
+        }
+        exit(0);
+      }
+    }
+    close(ab[0]);
+    close(ab[1]);
+    close(ba[0]);
+    close(ba[1]);
+  }
+  for(int i = 0; i < 2*NPAIR; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: a child failed\n", s);
+      exit(1);
+    }
+  }
+}
+
+// setpriority() takes nice values from -20 to 19, of processes
+// that exist. then, with a nice 19 spinner on every CPU, a nice
+// -20 and a nice 19 process run the same loop on one CPU; the
+// nice -20 one must get nearly all of it and finish first.
+void
+priority(char *s)
+{
+  int spin[NCPU], fast, slow, pid, xstatus;
+
+  if(setpriority(getpid(), 20) >= 0 || setpriority(getpid(), -21) >= 0){
+    printf("%s: setpriority took a bad nice value\n", s);
+    exit(1);
+  }
+  if(setpriority(-1, 0) >= 0){
+    printf("%s: setpriority of a bad pid succeeded\n", s);
+    exit(1);
+  }
+
+  for(int i = 0; i < NCPU; i++){
+    spin[i] = fork();
+    if(spin[i] < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(spin[i] == 0){
+      setpriority(getpid(), 19);
+      for(;;)
+        ;
+    }
+  }
+  // let idle CPUs take spinners, so that none is idle and the
+  // two forked next stay on this CPU's run queue.
+  pause(2);
+
+  fast = slow = 0;
+  for(int i = 0; i < 2; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      if(setpriority(getpid(), i == 0 ? -20 : 19) < 0)
+        exit(1);
+      for(volatile int j = 0; j < 20000000; j++)
+        ;
+      exit(0);
+    }
+    if(i == 0)
+      fast = pid;
+    else
+      slow = pid;
+  }
+
+  pid = wait(&xstatus);
+  kill(fast);
+  kill(slow);
+  for(int i = 0; i < NCPU; i++)
+    kill(spin[i]);
+  while(wait(0) > 0)
+    ;
+  setpriority(getpid(), 0);
+  if(xstatus != 0){
+    printf("%s: setpriority failed\n", s);
+    exit(1);
+  }
+  if(pid != fast){
+    printf("%s: nice 19 finished before nice -20\n", s);
+    exit(1);
+  }
+}
+
+// nanosleep() must not round up to whole ticks:
+// twenty 10ms sleeps should take about 200ms,
+// well short of twenty ticks.
+void
+nanosleeptest(char *s)
+{
+  int t0, t1;
+
+  if(nanosleep(0) != 0){
+    printf("%s: nanosleep(0) failed\n", s);
+    exit(1);
+  }
+  t0 = uptime();
+  for(int i = 0; i < 20; i++){
+    if(nanosleep(10000000) != 0){
+      printf("%s: nanosleep failed\n", s);
+      exit(1);
+    }
+  }
+  t1 = uptime();
+  if(t1 - t0 < 1 || t1 - t0 >= 20){
+    printf("%s: 20 10ms sleeps took %d ticks\n", s, t1 - t0);
+    exit(1);
+  }
+}
+
+// kill() and wait() find children by pid and by parent;
+// each child must be reaped exactly once, and its pid
+// must be gone afterwards.
+void
+killwait(char *s)
+{
+  enum { N = 20 };
+  int pids[N], pid, n;
+
+  for(int i = 0; i < N; i++){
+    pids[i] = fork();
+    if(pids[i] < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pids[i] == 0){
+      for(;;) pause(1000);
+    }
+  }
+  for(int i = N-1; i >= 0; i--){
+    if(kill(pids[i]) != 0){
+      printf("%s: kill %d failed\n", s, pids[i]);
+      exit(1);
+    }
+  }
+  for(n = 0; (pid = wait(0)) > 0; n++){
+    int i;
+    for(i = 0; i < N && pids[i] != pid; i++)
+      ;
+    if(i == N){
+      printf("%s: wait returned %d\n", s, pid);
+      exit(1);
+    }
+    pids[i] = -1;
+    if(kill(pid) != -1){
+      printf("%s: killed reaped pid %d\n", s, pid);
+      exit(1);
+    }
+  }
+  if(n != N){
+    printf("%s: reaped %d of %d children\n", s, n, N);
+    exit(1);
+  }
+}
+
 void
 forkforkfork(char *s)
 {
@@ -2748,189 +2944,745 @@ lazy_sbrk(char *s)
   exit(0);
 }
 
-struct test {
-  void (*f)(char *);
-  char *s;
-} quicktests[] = {
-  {copyin, "copyin"},
-  {copyout, "copyout"},
-  {copyinstr1, "copyinstr1"},
-  {copyinstr2, "copyinstr2"},
-  {copyinstr3, "copyinstr3"},
-  {rwsbrk, "rwsbrk" },
-  {truncate1, "truncate1"},
-  {truncate2, "truncate2"},
-  {truncate3, "truncate3"},
-  {openiputtest, "openiput"},
-  {exitiputtest, "exitiput"},
-  {iputtest, "iput"},
-  {opentest, "opentest"},
-  {writetest, "writetest"},
-  {writebig, "writebig"},
-  {createtest, "createtest"},
-  {dirtest, "dirtest"},
-  {exectest, "exectest"},
-  {pipe1, "pipe1"},
-  {killstatus, "killstatus"},
-  {preempt, "preempt"},
-  {exitwait, "exitwait"},
-  {reparent, "reparent" },
-  {twochildren, "twochildren"},
-  {forkfork, "forkfork"},
-  {forkforkfork, "forkforkfork"},
-  {reparent2, "reparent2"},
-  {mem, "mem"},
-  {sharedfd, "sharedfd"},
-  {fourfiles, "fourfiles"},
-  {createdelete, "createdelete"},
-  {unlinkread, "unlinkread"},
-  {linktest, "linktest"},
-  {concreate, "concreate"},
-  {linkunlink, "linkunlink"},
-  {subdir, "subdir"},
-  {bigwrite, "bigwrite"},
-  {bigfile, "bigfile"},
-  {fourteen, "fourteen"},
-  {rmdot, "rmdot"},
-  {dirfile, "dirfile"},
-  {iref, "iref"},
-  {forktest, "forktest"},
-  {sbrkbasic, "sbrkbasic"},
-  {sbrkmuch, "sbrkmuch"},
-  {kernmem, "kernmem"},
-  {MAXVAplus, "MAXVAplus"},
-  {sbrkfail, "sbrkfail"},
-  {sbrkarg, "sbrkarg"},
-  {validatetest, "validatetest"},
-  {bsstest, "bsstest"},
-  {bigargtest, "bigargtest"},
-  {argptest, "argptest"},
-  {stacktest, "stacktest"},
-  {nowrite, "nowrite"},
-  {pgbug, "pgbug" },
-  {sbrkbugs, "sbrkbugs" },
-  {sbrklast, "sbrklast"},
-  {sbrk8000, "sbrk8000"},
-  {badarg, "badarg" },
-  {lazy_alloc, "lazy_alloc"},
-  {lazy_unmap, "lazy_unmap"},
-  {lazy_copy, "lazy_copy"},
-  {lazy_sbrk, "lazy_sbrk"},
-  { 0, 0},
-};
-
-//
-// Section with tests that take a fair bit of time
-//
-
-// directory that uses indirect blocks
+// fork() of a process that uses more than half of physical memory
+// only succeeds if the kernel shares the pages copy-on-write. each
+// process must then see only its own writes.
 void
-bigdir(char *s)
+cowfork(char *s)
 {
-  enum { N = 500 };
-  int i, fd;
-  char name[10];
-
-  unlink("bd");
+  uint64 sz = (PHYSTOP - KERNBASE) / 3 * 2;
+  int parent = getpid();
 
-  fd = open("bd", O_CREATE);
-  if(fd < 0){
-    printf("%s: bigdir create failed\n", s);
+  char *a = sbrk(sz);
+  if(a == SBRK_ERROR){
+    printf("%s: sbrk(%ld) failed\n", s, sz);
     exit(1);
   }
-  close(fd);
-
-  for(i = 0; i < N; i++){
-    name[0] = 'x';
-    name[1] = '0' + (i / 64);
-    name[2] = '0' + (i % 64);
-    name[3] = '\0';
-    if(link("bd", name) != 0){
-      printf("%s: bigdir i=%d link(bd, %s) failed\n", s, i, name);
-      exit(1);
-    }
-  }
-
-  unlink("bd");
-  for(i = 0; i < N; i++){
-    name[0] = 'x';
-    name[1] = '0' + (i / 64);
-    name[2] = '0' + (i % 64);
-    name[3] = '\0';
-    if(unlink(name) != 0){
-      printf("%s: bigdir unlink failed", s);
-      exit(1);
-    }
-  }
-}
+  for(char *q = a; q < a + sz; q += PGSIZE)
+    *(int*)q = parent;
 
-// concurrent writes to try to provoke deadlock in the virtio disk
-// driver.
-void
-manywrites(char *s)
-{
-  int nchildren = 4;
-  int howmany = 30; // increase to look for deadlock
-  
-  for(int ci = 0; ci < nchildren; ci++){
+  for(int i = 0; i < 3; i++){
     int pid = fork();
     if(pid < 0){
-      printf("fork failed\n");
+      printf("%s: fork failed\n", s);
       exit(1);
     }
-
     if(pid == 0){
-      char name[3];
-      name[0] = 'b';
-      name[1] = 'a' + ci;
-      name[2] = '\0';
-      unlink(name);
-      
-      for(int iters = 0; iters < howmany; iters++){
-        for(int i = 0; i < ci+1; i++){
-          int fd = open(name, O_CREATE | O_RDWR);
-          if(fd < 0){
-            printf("%s: cannot create %s\n", s, name);
-            exit(1);
-          }
-          int sz = sizeof(buf);
-          int cc = write(fd, buf, sz);
-          if(cc != sz){
-            printf("%s: write(%d) ret %d\n", s, sz, cc);
-            exit(1);
-          }
-          close(fd);
+      for(char *q = a; q < a + sz; q += 64*PGSIZE){
+        if(*(int*)q != parent){
+          printf("%s: child sees wrong data\n", s);
+          exit(1);
         }
-        unlink(name);
+        *(int*)q = getpid();
       }
-
-      unlink(name);
       exit(0);
     }
-  }
-
-  for(int ci = 0; ci < nchildren; ci++){
     int st = 0;
     wait(&st);
     if(st != 0)
-      exit(st);
+      exit(1);
+    for(char *q = a; q < a + sz; q += PGSIZE){
+      if(*(int*)q != parent){
+        printf("%s: child write visible in parent\n", s);
+        exit(1);
+      }
+    }
   }
-  exit(0);
+  sbrk(-(int)sz);
 }
 
-// regression test. does write() with an invalid buffer pointer cause
-// a block to be allocated for a file that is then not freed when the
-// file is deleted? if the kernel has this bug, it will panic: balloc:
-// out of blocks. assumed_free may need to be raised to be more than
-// the number of free blocks. this test takes a long time.
+// sequential reads through two file descriptors at once, with
+// read sizes that don't line up with blocks, so that the
+// readahead of one descriptor overlaps reads of the other.
 void
-badwrite(char *s)
+seqread(char *s)
 {
-  int assumed_free = 600;
-  
-  unlink("junk");
-  for(int i = 0; i < assumed_free; i++){
-    int fd = open("junk", O_CREATE|O_WRONLY);
+  enum { NBLK = 200, SZ1 = 700, SZ2 = 3*BSIZE };
+  char *file = "seqread";
+  int fd, fd1, fd2, off1, off2, n;
+
+  unlink(file);
+  fd = open(file, O_CREATE | O_WRONLY);
+  if(fd < 0){
+    printf("%s: cannot create %s\n", s, file);
+    exit(1);
+  }
+  for(int i = 0; i < NBLK; i++){
+    for(int j = 0; j < BSIZE; j++)
+      buf[j] = i ^ (j % 251);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd1 = open(file, O_RDONLY);
+  fd2 = open(file, O_RDONLY);
+  if(fd1 < 0 || fd2 < 0){
+    printf("%s: cannot open %s\n", s, file);
+    exit(1);
+  }
+  off1 = off2 = 0;
+  while(off1 < NBLK*BSIZE || off2 < NBLK*BSIZE){
+    if((n = read(fd1, buf, SZ1)) > 0){
+      for(int j = 0; j < n; j++, off1++){
+        if(buf[j] != (char)(off1/BSIZE ^ (off1%BSIZE) % 251)){
+          printf("%s: fd1 wrong byte at %d\n", s, off1);
+          exit(1);
+        }
+      }
+    }
+    if((n = read(fd2, buf, SZ2)) > 0){
+      for(int j = 0; j < n; j++, off2++){
+        if(buf[j] != (char)(off2/BSIZE ^ (off2%BSIZE) % 251)){
+          printf("%s: fd2 wrong byte at %d\n", s, off2);
+          exit(1);
+        }
+      }
+    }
+  }
+  if(read(fd1, buf, 1) != 0 || read(fd2, buf, 1) != 0){
+    printf("%s: read past end of file\n", s);
+    exit(1);
+  }
+  close(fd1);
+  close(fd2);
+  unlink(file);
+}
+
+// one large write() that filewrite() must split into several
+// transactions, starting off a block boundary, so that each
+// chunk allocates a run of new blocks and fills part of one.
+void
+largewrite(char *s)
+{
+  enum { SZ = 150*BSIZE + 100, OFF = 300 };
+  char *file = "largewrite";
+  char *p;
+  int fd, n;
+
+  p = sbrk(SZ);
+  if(p == SBRK_ERROR){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < SZ; i++)
+    p[i] = i % 253;
+
+  unlink(file);
+  fd = open(file, O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create %s\n", s, file);
+    exit(1);
+  }
+  if(write(fd, p, OFF) != OFF || write(fd, p + OFF, SZ - OFF) != SZ - OFF){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open(file, O_RDONLY);
+  if(fd < 0){
+    printf("%s: cannot open %s\n", s, file);
+    exit(1);
+  }
+  for(int off = 0; off < SZ; off += n){
+    if((n = read(fd, buf, BSIZE)) <= 0){
+      printf("%s: short read at %d\n", s, off);
+      exit(1);
+    }
+    for(int j = 0; j < n; j++){
+      if(buf[j] != (char)((off + j) % 253)){
+        printf("%s: wrong byte at %d\n", s, off + j);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  unlink(file);
+  sbrk(-SZ);
+}
+
+// two files written a block at a time in turn, so that neither
+// gets two adjacent blocks, and each needs more extents than the
+// inode and its extent block hold.
+void
+fragfile(char *s)
+{
+  enum { NBLK = 300 };
+  char *names[2] = { "frag0", "frag1" };
+  int fds[2];
+
+  for(int f = 0; f < 2; f++){
+    unlink(names[f]);
+    fds[f] = open(names[f], O_CREATE | O_RDWR);
+    if(fds[f] < 0){
+      printf("%s: cannot create %s\n", s, names[f]);
+      exit(1);
+    }
+  }
+  for(int i = 0; i < NBLK; i++){
+    for(int f = 0; f < 2; f++){
+      memset(buf, 'a' + f, BSIZE);
+      ((int*)buf)[0] = i;
+      if(write(fds[f], buf, BSIZE) != BSIZE){
+        printf("%s: write %s block %d failed\n", s, names[f], i);
+        exit(1);
+      }
+    }
+  }
+  for(int f = 0; f < 2; f++){
+    close(fds[f]);
+    fds[f] = open(names[f], O_RDONLY);
+    if(fds[f] < 0){
+      printf("%s: cannot open %s\n", s, names[f]);
+      exit(1);
+    }
+    for(int i = 0; i < NBLK; i++){
+      if(read(fds[f], buf, BSIZE) != BSIZE || ((int*)buf)[0] != i ||
+         buf[BSIZE-1] != 'a' + f){
+        printf("%s: %s block %d wrong\n", s, names[f], i);
+        exit(1);
+      }
+    }
+    if(read(fds[f], buf, 1) != 0){
+      printf("%s: %s too long\n", s, names[f]);
+      exit(1);
+    }
+    close(fds[f]);
+    unlink(names[f]);
+  }
+}
+
+// small appends, which share commits unless each is followed
+// by fsync(). reports how long each kind took.
+void
+fsynctest(char *s)
+{
+  enum { N = 200, NSYNC = 20 };
+  int fd, t0, t1;
+  char *name = "fsyncf";
+
+  if(fsync(-1) >= 0 || fsync(NOFILE) >= 0){
+    printf("%s: fsync of bad fd succeeded\n", s);
+    exit(1);
+  }
+  unlink(name);
+  fd = open(name, O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create %s\n", s, name);
+    exit(1);
+  }
+  t0 = uptime();
+  for(int i = 0; i < N; i++){
+    if(write(fd, "0123456789abcdef", 16) != 16){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  t1 = uptime();
+  for(int i = 0; i < NSYNC; i++){
+    if(write(fd, "0123456789abcdef", 16) != 16 || fsync(fd) != 0){
+      printf("%s: write or fsync failed\n", s);
+      exit(1);
+    }
+  }
+  printf("%d writes in %d ticks, %d fsynced in %d ticks ",
+         N, t1 - t0, NSYNC, uptime() - t1);
+  close(fd);
+  fd = open(name, O_RDONLY);
+  if(fd < 0 || read(fd, buf, BUFSZ) != 16*(N+NSYNC)){
+    printf("%s: wrong size\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink(name);
+}
+
+// splice a file into a pipe, and a pipe into a file, and
+// check that the bytes arrive in order.
+void
+splicetest(char *s)
+{
+  enum { SZ = 10000 };  // less than BUFSZ, more than two pages
+  int fd, fds[2], pid, xstatus, n, tot;
+  char *name = "splicef";
+
+  unlink(name);
+  fd = open(name, O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create %s\n", s, name);
+    exit(1);
+  }
+  for(int i = 0; i < SZ; i++)
+    buf[i] = i;
+  if(write(fd, buf, SZ) != SZ){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(splice(fd, fd, 1) >= 0){
+    printf("%s: splice between files succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // file to pipe.
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    fd = open(name, O_RDONLY);
+    if(fd < 0 || splice(fd, fds[1], 2*SZ) != SZ){
+      printf("%s: splice into pipe failed\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  tot = 0;
+  while((n = read(fds[0], buf, 1000)) > 0){
+    for(int i = 0; i < n; i++){
+      if((buf[i] & 0xff) != ((tot + i) & 0xff)){
+        printf("%s: wrong byte %d from pipe\n", s, tot + i);
+        exit(1);
+      }
+    }
+    tot += n;
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(tot != SZ){
+    printf("%s: read %d bytes from pipe\n", s, tot);
+    exit(1);
+  }
+
+  // pipe to file.
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(int i = 0; i < SZ; i++)
+      buf[i] = SZ - i;
+    if(write(fds[1], buf, SZ) != SZ){
+      printf("%s: write into pipe failed\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  fd = open(name, O_RDWR | O_TRUNC);
+  if(fd < 0 || splice(fds[0], fd, 2*SZ) != SZ){
+    printf("%s: splice from pipe failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(fds[0]);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  fd = open(name, O_RDONLY);
+  if(fd < 0 || read(fd, buf, BUFSZ) != SZ){
+    printf("%s: file has the wrong size\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < SZ; i++){
+    if((buf[i] & 0xff) != ((SZ - i) & 0xff)){
+      printf("%s: wrong byte %d in file\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink(name);
+}
+
+// path lookups must see directory changes, including
+// lookups that failed before, and ".." in a directory that
+// may reuse the i-number of a removed one.
+void
+dcachetest(char *s)
+{
+  struct stat st1, st2;
+  int fd;
+
+  unlink("dc/a/x");
+  unlink("dc/a/d");
+  unlink("dc/b/d");
+  unlink("dc/a");
+  unlink("dc/b");
+  unlink("dc");
+  if(mkdir("dc") < 0 || mkdir("dc/a") < 0 || mkdir("dc/b") < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+
+  // a failed lookup, then create the name.
+  if(open("dc/a/x", O_RDONLY) >= 0){
+    printf("%s: opened missing file\n", s);
+    exit(1);
+  }
+  fd = open("dc/a/x", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("dc/a/x", O_RDONLY)) < 0){
+    printf("%s: cannot open new file\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // remove it, then look it up again, twice.
+  if(unlink("dc/a/x") < 0){
+    printf("%s: unlink failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < 2; i++){
+    if(open("dc/a/x", O_RDONLY) >= 0){
+      printf("%s: opened removed file\n", s);
+      exit(1);
+    }
+  }
+
+  // look up ".." in dc/a/d, remove dc/a/d, and make dc/b/d,
+  // which likely gets the same i-number. its ".." is dc/b.
+  if(mkdir("dc/a/d") < 0 || stat("dc/a/d/..", &st1) < 0){
+    printf("%s: mkdir dc/a/d failed\n", s);
+    exit(1);
+  }
+  if(unlink("dc/a/d") < 0 || mkdir("dc/b/d") < 0){
+    printf("%s: unlink or mkdir failed\n", s);
+    exit(1);
+  }
+  if(stat("dc/b/d/..", &st1) < 0 || stat("dc/b", &st2) < 0 || st1.ino != st2.ino){
+    printf("%s: wrong ..\n", s);
+    exit(1);
+  }
+  if(stat("dc/a/d", &st1) >= 0){
+    printf("%s: removed directory still there\n", s);
+    exit(1);
+  }
+
+  unlink("dc/b/d");
+  unlink("dc/a");
+  unlink("dc/b");
+  unlink("dc");
+}
+
+// dirhash() in kernel/fs.c.
+uint
+hdhash(char *name)
+{
+  uint h = 2166136261;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h % NHBUCKET;
+}
+
+// more names than a block holds, all in the same bucket of a
+// hashed directory made by mkdir(), so that the bucket must
+// grow a second block. then remove half and make them again:
+// they must reuse the free slots rather than grow the
+// directory.
+void
+hashdir(char *s)
+{
+  enum { N = DPB + DPB/2 };
+  static char names[N][DIRSIZ+4];
+  struct stat st;
+  int n, fd;
+  uint size;
+
+  // hd/0 ... hd/N-1 by number, but only those in hd/0's bucket.
+  n = 0;
+  for(int i = 0; n < N; i++){
+    char *p = names[n];
+    int len = 0;
+    p[len++] = 'h';
+    p[len++] = 'd';
+    p[len++] = '/';
+    for(int d = 100000; d > 0; d /= 10)
+      if(i >= d || d == 1)
+        p[len++] = '0' + (i/d)%10;
+    p[len] = '\0';
+    if(hdhash(p+3) == hdhash("0"))
+      n++;
+  }
+
+  if(mkdir("hd") < 0){
+    printf("%s: mkdir hd failed\n", s);
+    exit(1);
+  }
+  fd = open("hd/f", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: create hd/f failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(int i = 0; i < N; i++){
+    if(link("hd/f", names[i]) < 0){
+      printf("%s: link %s failed\n", s, names[i]);
+      exit(1);
+    }
+  }
+  if(stat("hd", &st) < 0){
+    printf("%s: stat hd failed\n", s);
+    exit(1);
+  }
+  size = st.size;
+
+  for(int round = 0; round < 2; round++){
+    for(int i = round; i < N; i += 2){
+      if(unlink(names[i]) < 0){
+        printf("%s: unlink %s failed\n", s, names[i]);
+        exit(1);
+      }
+    }
+    for(int i = 0; i < N; i++){
+      fd = open(names[i], O_RDONLY);
+      if((fd >= 0) != (i % 2 != round)){
+        printf("%s: %s %s\n", s, names[i], fd >= 0 ? "still there" : "missing");
+        exit(1);
+      }
+      if(fd >= 0)
+        close(fd);
+    }
+    for(int i = round; i < N; i += 2){
+      if(link("hd/f", names[i]) < 0){
+        printf("%s: link %s again failed\n", s, names[i]);
+        exit(1);
+      }
+    }
+    if(stat("hd", &st) < 0 || st.size != size){
+      printf("%s: hd grew from %d to %d bytes\n", s, size, (int)st.size);
+      exit(1);
+    }
+  }
+
+  for(int i = 0; i < N; i++)
+    unlink(names[i]);
+  unlink("hd/f");
+  if(unlink("hd") < 0){
+    printf("%s: unlink of emptied hd failed\n", s);
+    exit(1);
+  }
+}
+
+struct test {
+  void (*f)(char *);
+  char *s;
+} quicktests[] = {
+  {copyin, "copyin"},
+  {copyout, "copyout"},
+  {copyinstr1, "copyinstr1"},
+  {copyinstr2, "copyinstr2"},
+  {copyinstr3, "copyinstr3"},
+  {rwsbrk, "rwsbrk" },
+  {truncate1, "truncate1"},
+  {truncate2, "truncate2"},
+  {truncate3, "truncate3"},
+  {openiputtest, "openiput"},
+  {exitiputtest, "exitiput"},
+  {iputtest, "iput"},
+  {opentest, "opentest"},
+  {writetest, "writetest"},
+  {writebig, "writebig"},
+  {createtest, "createtest"},
+  {dirtest, "dirtest"},
+  {exectest, "exectest"},
+  {pipe1, "pipe1"},
+  {killstatus, "killstatus"},
+  {preempt, "preempt"},
+  {exitwait, "exitwait"},
+  {reparent, "reparent" },
+  {twochildren, "twochildren"},
+  {forkfork, "forkfork"},
+  {forkforkfork, "forkforkfork"},
+  {pingpong, "pingpong"},
+  {priority, "priority"},
+  {nanosleeptest, "nanosleep"},
+  {killwait, "killwait"},
+  {reparent2, "reparent2"},
+  {mem, "mem"},
+  {sharedfd, "sharedfd"},
+  {fourfiles, "fourfiles"},
+  {createdelete, "createdelete"},
+  {unlinkread, "unlinkread"},
+  {linktest, "linktest"},
+  {concreate, "concreate"},
+  {linkunlink, "linkunlink"},
+  {subdir, "subdir"},
+  {bigwrite, "bigwrite"},
+  {bigfile, "bigfile"},
+  {fourteen, "fourteen"},
+  {rmdot, "rmdot"},
+  {dirfile, "dirfile"},
+  {iref, "iref"},
+  {forktest, "forktest"},
+  {sbrkbasic, "sbrkbasic"},
+  {sbrkmuch, "sbrkmuch"},
+  {kernmem, "kernmem"},
+  {MAXVAplus, "MAXVAplus"},
+  {sbrkfail, "sbrkfail"},
+  {sbrkarg, "sbrkarg"},
+  {validatetest, "validatetest"},
+  {bsstest, "bsstest"},
+  {bigargtest, "bigargtest"},
+  {argptest, "argptest"},
+  {stacktest, "stacktest"},
+  {nowrite, "nowrite"},
+  {pgbug, "pgbug" },
+  {sbrkbugs, "sbrkbugs" },
+  {sbrklast, "sbrklast"},
+  {sbrk8000, "sbrk8000"},
+  {badarg, "badarg" },
+  {lazy_alloc, "lazy_alloc"},
+  {lazy_unmap, "lazy_unmap"},
+  {lazy_copy, "lazy_copy"},
+  {lazy_sbrk, "lazy_sbrk"},
+  {cowfork, "cowfork"},
+  {seqread, "seqread"},
+  {largewrite, "largewrite"},
+  {fragfile, "fragfile"},
+  {fsynctest, "fsync"},
+  {splicetest, "splice"},
+  {dcachetest, "dcache"},
+  {hashdir, "hashdir"},
+  { 0, 0},
+};
+
+//
+// Section with tests that take a fair bit of time
+//
+
+// directory that uses indirect blocks
+void
+bigdir(char *s)
+{
+  enum { N = 500 };
+  int i, fd;
+  char name[10];
+
+  unlink("bd");
+
+  fd = open("bd", O_CREATE);
+  if(fd < 0){
+    printf("%s: bigdir create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < N; i++){
+    name[0] = 'x';
+    name[1] = '0' + (i / 64);
+    name[2] = '0' + (i % 64);
+    name[3] = '\0';
+    if(link("bd", name) != 0){
+      printf("%s: bigdir i=%d link(bd, %s) failed\n", s, i, name);
+      exit(1);
+    }
+  }
+
+  unlink("bd");
+  for(i = 0; i < N; i++){
+    name[0] = 'x';
+    name[1] = '0' + (i / 64);
+    name[2] = '0' + (i % 64);
+    name[3] = '\0';
+    if(unlink(name) != 0){
+      printf("%s: bigdir unlink failed", s);
+      exit(1);
+    }
+  }
+}
+
+// concurrent writes to try to provoke deadlock in the virtio disk
+// driver.
+void
+manywrites(char *s)
+{
+  int nchildren = 4;
+  int howmany = 30; // increase to look for deadlock
+  
+  for(int ci = 0; ci < nchildren; ci++){
+    int pid = fork();
+    if(pid < 0){
+      printf("fork failed\n");
+      exit(1);
+    }
+
+    if(pid == 0){
+      char name[3];
+      name[0] = 'b';
+      name[1] = 'a' + ci;
+      name[2] = '\0';
+      unlink(name);
+      
+      for(int iters = 0; iters < howmany; iters++){
+        for(int i = 0; i < ci+1; i++){
+          int fd = open(name, O_CREATE | O_RDWR);
+          if(fd < 0){
+            printf("%s: cannot create %s\n", s, name);
+            exit(1);
+          }
+          int sz = sizeof(buf);
+          int cc = write(fd, buf, sz);
+          if(cc != sz){
+            printf("%s: write(%d) ret %d\n", s, sz, cc);
+            exit(1);
+          }
+          close(fd);
+        }
+        unlink(name);
+      }
+
+      unlink(name);
+      exit(0);
+    }
+  }
+
+  for(int ci = 0; ci < nchildren; ci++){
+    int st = 0;
+    wait(&st);
+    if(st != 0)
+      exit(st);
+  }
+  exit(0);
+}
+
+// regression test. does write() with an invalid buffer pointer cause
+// a block to be allocated for a file that is then not freed when the
+// file is deleted? if the kernel has this bug, it will panic: balloc:
+// out of blocks. assumed_free may need to be raised to be more than
+// the number of free blocks. this test takes a long time.
+void
+badwrite(char *s)
+{
+  int assumed_free = 600;
+  
+  unlink("junk");
+  for(int i = 0; i < assumed_free; i++){
+    int fd = open("junk", O_CREATE|O_WRONLY);
     if(fd < 0){
       printf("open junk failed\n");
       exit(1);
@@ -3104,6 +3856,415 @@ outofinodes(char *s)
   }
 }
 
+// run op(s, ci) for ci = 0..nchild-1, each in its own child,
+// all at once. returns how many ticks they took, or -1 if
+// any child failed.
+int
+stresschildren(char *s, int nchild, void (*op)(char *, int))
+{
+  int t0, failed = 0;
+
+  t0 = uptime();
+  for(int ci = 0; ci < nchild; ci++){
+    int pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      op(s, ci);
+      exit(0);
+    }
+  }
+  for(int ci = 0; ci < nchild; ci++){
+    int st = 0;
+    wait(&st);
+    if(st != 0)
+      failed = 1;
+  }
+  return failed ? -1 : uptime() - t0;
+}
+
+#define BCNCHILD 4
+#define BCNBLK 16
+#define BCNROUND 50
+
+// one bcachestress child: read its own file over and over.
+void
+bcachereader(char *s, int ci)
+{
+  char b[BSIZE];
+  char name[3];
+
+  name[0] = 'c';
+  name[1] = 'a' + ci;
+  name[2] = '\0';
+  for(int r = 0; r < BCNROUND; r++){
+    int fd = open(name, O_RDONLY);
+    if(fd < 0){
+      printf("%s: cannot open %s\n", s, name);
+      exit(1);
+    }
+    for(int i = 0; i < BCNBLK; i++){
+      if(read(fd, b, BSIZE) != BSIZE || b[0] != 'a' + ci || b[BSIZE-1] != 'a' + ci){
+        printf("%s: read %s block %d wrong\n", s, name, i);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+}
+
+// concurrent reads of different blocks by several processes, to
+// exercise the per-bucket locks in the buffer cache. if the cache
+// is small, bget() must also steal buffers across buckets.
+// reports how long the reads took.
+void
+bcachestress(char *s)
+{
+  char name[3];
+  int t;
+
+  name[2] = '\0';
+  for(int ci = 0; ci < BCNCHILD; ci++){
+    name[0] = 'c';
+    name[1] = 'a' + ci;
+    unlink(name);
+    int fd = open(name, O_CREATE | O_RDWR);
+    if(fd < 0){
+      printf("%s: cannot create %s\n", s, name);
+      exit(1);
+    }
+    for(int i = 0; i < BCNBLK; i++){
+      memset(buf, 'a' + ci, BSIZE);
+      if(write(fd, buf, BSIZE) != BSIZE){
+        printf("%s: write %s failed\n", s, name);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+
+  t = stresschildren(s, BCNCHILD, bcachereader);
+  printf("%d block reads in %d ticks ", BCNCHILD*BCNBLK*BCNROUND, t);
+
+  for(int ci = 0; ci < BCNCHILD; ci++){
+    name[0] = 'c';
+    name[1] = 'a' + ci;
+    unlink(name);
+  }
+  if(t < 0)
+    exit(1);
+}
+
+// write, then read back, a file larger than the buffer cache,
+// and report the throughput of each.
+void
+bigfilebench(char *s)
+{
+  enum { MB = 8, NBLK = MB*1024*1024/BSIZE, CHUNK = 8*BSIZE };
+  char *file = "bigfilebench";
+  int fd, t0, t1, t2;
+
+  unlink(file);
+  fd = open(file, O_CREATE | O_WRONLY);
+  if(fd < 0){
+    printf("%s: cannot create %s\n", s, file);
+    exit(1);
+  }
+  t0 = uptime();
+  for(int i = 0; i < NBLK; i += CHUNK/BSIZE){
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, CHUNK) != CHUNK){
+      printf("%s: write failed at block %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  t1 = uptime();
+
+  fd = open(file, O_RDONLY);
+  if(fd < 0){
+    printf("%s: cannot open %s\n", s, file);
+    exit(1);
+  }
+  for(int i = 0; i < NBLK; i += CHUNK/BSIZE){
+    if(read(fd, buf, CHUNK) != CHUNK || ((int*)buf)[0] != i){
+      printf("%s: read block %d wrong\n", s, i);
+      exit(1);
+    }
+  }
+  if(read(fd, buf, 1) != 0){
+    printf("%s: file too long\n", s);
+    exit(1);
+  }
+  close(fd);
+  t2 = uptime();
+  unlink(file);
+
+  // ticks are about 1/10 second.
+  printf("%d MB: write %d KB/s, read %d KB/s ", MB,
+         MB*1024*10 / (t1 - t0 > 0 ? t1 - t0 : 1),
+         MB*1024*10 / (t2 - t1 > 0 ? t2 - t1 : 1));
+}
+
+// a child writes MB megabytes into a pipe, checked by the
+// parent as it reads; reports the throughput.
+void
+pipebench(char *s)
+{
+  enum { MB = 16, CHUNK = 8*1024, N = MB*1024*1024/CHUNK };
+  int fds[2], pid, xstatus, t0, n, cc;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(int i = 0; i < N; i++){
+      ((int*)buf)[0] = i;
+      if(write(fds[1], buf, CHUNK) != CHUNK){
+        printf("%s: write failed\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  for(int i = 0; i < N; i++){
+    for(n = 0; n < CHUNK; n += cc){
+      if((cc = read(fds[0], buf + n, CHUNK - n)) <= 0){
+        printf("%s: read failed\n", s);
+        exit(1);
+      }
+    }
+    if(((int*)buf)[0] != i){
+      printf("%s: chunk %d wrong\n", s, i);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  // ticks are about 1/10 second.
+  t0 = uptime() - t0;
+  printf("%d MB: %d KB/s ", MB, MB*1024*10 / (t0 > 0 ? t0 : 1));
+}
+
+#define INCHILD 4
+#define INF 100   // files, with two-digit names
+#define INROUND 20
+
+// one istress child: open and fstat every file, starting
+// at a different one from the other children.
+void
+iopener(char *s, int ci)
+{
+  struct stat st;
+  char name[4];
+
+  name[0] = 'i';
+  name[3] = '\0';
+  for(int r = 0; r < INROUND; r++){
+    for(int i = 0; i < INF; i++){
+      int j = (i + ci*INF/INCHILD) % INF;
+      name[1] = '0' + j/10;
+      name[2] = '0' + j%10;
+      int fd = open(name, O_RDONLY);
+      if(fd < 0 || fstat(fd, &st) < 0 || st.size != j){
+        printf("%s: %s wrong\n", s, name);
+        exit(1);
+      }
+      close(fd);
+    }
+  }
+}
+
+// concurrent opens and fstats of many files by several
+// processes, to exercise the per-bucket locks in the inode
+// table. the table, sized from free memory, has more entries
+// than mkfs makes i-nodes, so this doesn't force recycling.
+// reports how long the opens took.
+void
+istress(char *s)
+{
+  char name[4];
+  int t;
+
+  name[0] = 'i';
+  name[3] = '\0';
+  for(int i = 0; i < INF; i++){
+    name[1] = '0' + i/10;
+    name[2] = '0' + i%10;
+    unlink(name);
+    int fd = open(name, O_CREATE | O_RDWR);
+    if(fd < 0 || write(fd, buf, i) != i){
+      printf("%s: cannot create %s\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  t = stresschildren(s, INCHILD, iopener);
+  printf("%d opens in %d ticks ", INCHILD*INF*INROUND, t);
+
+  for(int i = 0; i < INF; i++){
+    name[1] = '0' + i/10;
+    name[2] = '0' + i%10;
+    unlink(name);
+  }
+  if(t < 0)
+    exit(1);
+}
+
+// use up all the i-nodes, and then all the blocks, free them,
+// and do it again: the allocator's count of what is free must
+// come back to where it was. reports how long each took.
+void
+refill(char *s)
+{
+  enum { NZ = 32*32 };
+  char name[8];
+  int n[2], fd, t0;
+
+  name[0] = 'r';
+  name[1] = 'f';
+  name[4] = '\0';
+  for(int round = 0; round < 2; round++){
+    t0 = uptime();
+    for(n[round] = 0; n[round] < NZ; n[round]++){
+      name[2] = '0' + n[round] / 32;
+      name[3] = '0' + n[round] % 32;
+      fd = open(name, O_CREATE | O_RDWR);
+      if(fd < 0)
+        break;
+      close(fd);
+    }
+    printf("%d inodes in %d ticks ", n[round], uptime() - t0);
+    for(int i = 0; i < n[round]; i++){
+      name[2] = '0' + i / 32;
+      name[3] = '0' + i % 32;
+      unlink(name);
+    }
+  }
+  if(n[0] == 0 || n[0] != n[1]){
+    printf("%s: got %d i-nodes, then %d\n", s, n[0], n[1]);
+    exit(1);
+  }
+
+  for(int round = 0; round < 2; round++){
+    t0 = uptime();
+    n[round] = 0;
+    for(int f = 0; ; f++){
+      name[2] = '0' + f / 32;
+      name[3] = '0' + f % 32;
+      fd = open(name, O_CREATE | O_RDWR);
+      if(fd < 0){
+        printf("%s: cannot create %s\n", s, name);
+        exit(1);
+      }
+      int i;
+      for(i = 0; i < MAXFILE && write(fd, buf, BSIZE) == BSIZE; i++)
+        ;
+      close(fd);
+      n[round] += i;
+      if(i < MAXFILE)
+        break;
+    }
+    printf("%d blocks in %d ticks ", n[round], uptime() - t0);
+    for(int f = 0; f <= n[round] / MAXFILE; f++){
+      name[2] = '0' + f / 32;
+      name[3] = '0' + f % 32;
+      unlink(name);
+    }
+  }
+  if(n[0] == 0 || n[0] != n[1]){
+    printf("%s: wrote %d blocks, then %d\n", s, n[0], n[1]);
+    exit(1);
+  }
+}
+
+// count the i-nodes that can be allocated, leaving none free.
+// remove them with orphanclean().
+int
+orphanfill(void)
+{
+  char name[8];
+  int n, fd;
+
+  name[0] = 'o';
+  name[1] = 'f';
+  name[4] = '\0';
+  for(n = 0; n < 32*32; n++){
+    name[2] = '0' + n / 32;
+    name[3] = '0' + n % 32;
+    fd = open(name, O_CREATE | O_RDWR);
+    if(fd < 0)
+      break;
+    close(fd);
+  }
+  return n;
+}
+
+void
+orphanclean(int n)
+{
+  char name[8];
+
+  name[0] = 'o';
+  name[1] = 'f';
+  name[4] = '\0';
+  for(int i = 0; i < n; i++){
+    name[2] = '0' + i / 32;
+    name[3] = '0' + i % 32;
+    unlink(name);
+  }
+}
+
+// several files unlinked while open, so that they are on the
+// orphan list together, then closed in a different order, so
+// that they come off it from the middle. they must all be freed.
+void
+orphanlist(char *s)
+{
+  enum { N = 5 };
+  int order[N] = { 2, 0, 4, 1, 3 };
+  int fds[N], n0, n1;
+  char name[3];
+
+  n0 = orphanfill();
+  orphanclean(n0);
+
+  name[0] = 'o';
+  name[2] = '\0';
+  for(int i = 0; i < N; i++){
+    name[1] = '0' + i;
+    fds[i] = open(name, O_CREATE | O_RDWR);
+    if(fds[i] < 0 || write(fds[i], "x", 1) != 1 || unlink(name) < 0){
+      printf("%s: create, write or unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(int i = 0; i < N; i++)
+    close(fds[order[i]]);
+
+  n1 = orphanfill();
+  orphanclean(n1);
+  if(n1 != n0){
+    printf("%s: %d i-nodes free before, %d after\n", s, n0, n1);
+    exit(1);
+  }
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
@@ -3111,6 +4272,12 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {bcachestress, "bcachestress"},
+  {bigfilebench, "bigfilebench"},
+  {pipebench, "pipebench"},
+  {istress, "istress"},
+  {refill, "refill"},
+  {orphanlist, "orphanlist"},
     
   { 0, 0},
 };
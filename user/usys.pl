@@ -42,3 +42,7 @@ entry("getpid");
 entry("sbrk");
 entry("pause");
 entry("uptime");
+entry("fsync");
+entry("splice");
+entry("setpriority");
+entry("nanosleep");